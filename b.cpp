@@ -46,22 +46,20 @@ auto co_main(ctx::continuation&& c)
 {
 	perror("==jd==3\n");
 
-	auto spV = make_shared<int>();
 	auto ctx = ctx::callcc(
-		[spV](ctx::continuation&& c2) mutable
+		[](ctx::continuation&& c2) mutable
 		{
 			for (int i = 0; i < 8; ++i)
 			{
-				*spV = i;
 				cout << "==jd==yielding " << i << endl;
-				c2 = c2.resume();
+				c2 = c2.resume(i);
 			}
 			return M__(c2);
 		});
 
 	for (int i = 0; i < 8; ++i)
 	{
-		cout << "==jd==get " << *spV << endl;
+		cout << "==jd==get " << ctx.get_data<int>() << endl;
 		ctx = ctx.resume();
 	}
 
@@ -0,0 +1,590 @@
+// same workloads three ways: ctx::continuation, C++20 coroutines, std::thread + condvar
+// usage: bench [scale]
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <coroutine>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include "mycontinuation_ucontext.hpp"
+#include <uv.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define F__(x) std::forward<decltype(x)>(x)
+#define M__(x) std::move(x)
+
+using namespace std;
+using bench_clock = chrono::steady_clock;
+
+static long ns_since(bench_clock::time_point t0)
+{
+	return chrono::duration_cast<chrono::nanoseconds>(bench_clock::now() - t0).count();
+}
+
+static long rss_kb()
+{
+	long size = 0, resident = 0;
+	ifstream("/proc/self/statm") >> size >> resident;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// VmHWM, reset to the current RSS by reset_peak_rss() (Linux 4.0+)
+static long peak_rss_kb()
+{
+	ifstream status("/proc/self/status");
+	string key;
+	long v = 0;
+	while (status >> key)
+	{
+		if ("VmHWM:" == key && status >> v)
+			return v;
+		status.ignore(256, '\n');
+	}
+	return 0;
+}
+
+static void reset_peak_rss()
+{
+	ofstream("/proc/self/clear_refs") << "5";
+}
+
+struct result
+{
+	vector<long> lat;
+	long total_ns = 0;
+	long rss_before = 0;
+	long rss_after = 0;
+	long rss_peak = 0;
+	rusage before{};
+	rusage after{};
+};
+
+template <class F>
+void measure(char const* workload, char const* impl, F&& f)
+{
+	result r;
+	reset_peak_rss();
+	r.rss_before = rss_kb();
+	getrusage(RUSAGE_SELF, &r.before);
+	auto t0 = bench_clock::now();
+	f(r.lat);
+	r.total_ns = ns_since(t0);
+	getrusage(RUSAGE_SELF, &r.after);
+	r.rss_after = rss_kb();
+	r.rss_peak = peak_rss_kb();
+
+	sort(r.lat.begin(), r.lat.end());
+	auto pct = [&](double p) { return r.lat.empty() ? 0 : r.lat[size_t(p * (r.lat.size() - 1))]; };
+	cout << left << setw(10) << workload << setw(14) << impl << right << setw(10) << r.lat.size();
+	cout << setw(14) << fixed << setprecision(0) << r.lat.size() * 1e9 / r.total_ns;
+	cout << setw(13) << pct(0.5) << setw(13) << pct(0.9) << setw(13) << pct(0.99) << setw(15) << pct(1.0);
+	// RSS growth over the case, at its peak and what is left afterwards
+	cout << setw(11) << r.rss_peak - r.rss_before << setw(11) << r.rss_after - r.rss_before;
+	cout << setw(9) << r.after.ru_nvcsw - r.before.ru_nvcsw << setw(9)
+		 << r.after.ru_nivcsw - r.before.ru_nivcsw << endl;
+}
+
+// ---- C++20 coroutine plumbing ----
+
+struct generator
+{
+	struct promise_type
+	{
+		int value = 0;
+		generator get_return_object()
+		{
+			return generator{coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		suspend_always initial_suspend() noexcept
+		{
+			return {};
+		}
+		suspend_always final_suspend() noexcept
+		{
+			return {};
+		}
+		suspend_always yield_value(int v) noexcept
+		{
+			value = v;
+			return {};
+		}
+		void unhandled_exception()
+		{
+			terminate();
+		}
+		void return_void()
+		{}
+	};
+
+	coroutine_handle<promise_type> h;
+
+	explicit generator(coroutine_handle<promise_type> h_) : h(h_)
+	{}
+	generator(generator&& o) : h(exchange(o.h, nullptr))
+	{}
+	~generator()
+	{
+		if (h)
+			h.destroy();
+	}
+
+	bool next()
+	{
+		h.resume();
+		return !h.done();
+	}
+	int value() const
+	{
+		return h.promise().value;
+	}
+};
+
+// lazily started, resumes its awaiter on completion
+struct task
+{
+	struct promise_type
+	{
+		int value = 0;
+		coroutine_handle<> awaiter;
+		task get_return_object()
+		{
+			return task{coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		suspend_always initial_suspend() noexcept
+		{
+			return {};
+		}
+		auto final_suspend() noexcept
+		{
+			struct final_awaiter
+			{
+				bool await_ready() noexcept
+				{
+					return false;
+				}
+				coroutine_handle<> await_suspend(coroutine_handle<promise_type> h) noexcept
+				{
+					auto a = h.promise().awaiter;
+					return a ? a : noop_coroutine();
+				}
+				void await_resume() noexcept
+				{}
+			};
+			return final_awaiter{};
+		}
+		void return_value(int v)
+		{
+			value = v;
+		}
+		void unhandled_exception()
+		{
+			terminate();
+		}
+	};
+
+	coroutine_handle<promise_type> h;
+
+	explicit task(coroutine_handle<promise_type> h_) : h(h_)
+	{}
+	task(task&& o) : h(exchange(o.h, nullptr))
+	{}
+	~task()
+	{
+		if (h)
+			h.destroy();
+	}
+
+	bool await_ready()
+	{
+		return false;
+	}
+	coroutine_handle<> await_suspend(coroutine_handle<> a)
+	{
+		h.promise().awaiter = a;
+		return h;
+	}
+	int await_resume()
+	{
+		return h.promise().value;
+	}
+};
+
+// ---- generator: consumer pulls N values ----
+
+void gen_continuation(vector<long>& lat, int n)
+{
+	auto g = ctx::callcc(std::allocator_arg, ctx::protected_fixedsize_stack(64 * 1024),
+						 [n](ctx::continuation&& c)
+						 {
+							 for (int i = 0; i < n; ++i)
+							 {
+								 c = c.resume(i);
+							 }
+							 return M__(c);
+						 });
+	long sum = 0;
+	while (g)
+	{
+		auto t0 = bench_clock::now();
+		sum += g.get_data<int>();
+		g = g.resume();
+		lat.push_back(ns_since(t0));
+	}
+	(void)sum;
+}
+
+generator gen_coro_body(int n)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		co_yield i;
+	}
+}
+
+void gen_coroutine(vector<long>& lat, int n)
+{
+	auto g = gen_coro_body(n);
+	long sum = 0;
+	for (;;)
+	{
+		auto t0 = bench_clock::now();
+		if (!g.next())
+			break;
+		sum += g.value();
+		lat.push_back(ns_since(t0));
+	}
+	(void)sum;
+}
+
+void gen_thread(vector<long>& lat, int n)
+{
+	mutex m;
+	condition_variable cv;
+	int value = 0;
+	bool full = false;
+	thread producer(
+		[&]
+		{
+			for (int i = 0; i < n; ++i)
+			{
+				unique_lock<mutex> lk(m);
+				cv.wait(lk, [&] { return !full; });
+				value = i;
+				full = true;
+				cv.notify_all();
+			}
+		});
+	long sum = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		auto t0 = bench_clock::now();
+		unique_lock<mutex> lk(m);
+		cv.wait(lk, [&] { return full; });
+		sum += value;
+		full = false;
+		cv.notify_all();
+		lat.push_back(ns_since(t0));
+	}
+	producer.join();
+	(void)sum;
+}
+
+// ---- timer chain: `chains` sequences of `steps` zero-delay libuv timers ----
+// latency: timer callback entry until the waiting code runs again
+
+struct chain_timer
+{
+	uv_timer_t timer;
+	bench_clock::time_point fired;
+	void* waiter = nullptr;
+};
+
+// the loop links every initialized handle, close them before their storage goes
+static void close_timer(chain_timer& t)
+{
+	uv_close((uv_handle_t*)&t.timer, nullptr);
+}
+
+struct timer_fiber
+{
+	chain_timer t;
+	ctx::continuation self;
+};
+
+void timer_continuation(vector<long>& lat, int chains, int steps)
+{
+	vector<timer_fiber> fibers(chains);
+	for (auto& f : fibers)
+	{
+		uv_timer_init(uv_default_loop(), &f.t.timer);
+		f.t.timer.data = &f;
+		// the fiber parks itself in f.self, callcc() hands back an empty continuation
+		ctx::callcc(std::allocator_arg, ctx::protected_fixedsize_stack(64 * 1024),
+					[&f, &lat, steps](ctx::continuation&& c)
+					{
+						for (int i = 0; i < steps; ++i)
+						{
+							ctx::park(c,
+									  [&f](ctx::continuation&& self)
+									  {
+										  f.self = M__(self);
+										  uv_timer_start(
+											  &f.t.timer,
+											  [](uv_timer_t* handle)
+											  {
+												  auto* f = (timer_fiber*)handle->data;
+												  f->t.fired = bench_clock::now();
+												  f->self.resume();
+											  },
+											  0, 0);
+									  });
+							lat.push_back(ns_since(f.t.fired));
+						}
+						return M__(c);
+					});
+	}
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	for (auto& f : fibers)
+		close_timer(f.t);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
+
+struct timer_awaiter
+{
+	chain_timer& t;
+
+	bool await_ready()
+	{
+		return false;
+	}
+	void await_suspend(coroutine_handle<> h)
+	{
+		t.waiter = h.address();
+		uv_timer_start(
+			&t.timer,
+			[](uv_timer_t* handle)
+			{
+				auto* t = (chain_timer*)handle->data;
+				t->fired = bench_clock::now();
+				coroutine_handle<>::from_address(t->waiter).resume();
+			},
+			0, 0);
+	}
+	void await_resume()
+	{}
+};
+
+task timer_coro_body(chain_timer& t, vector<long>& lat, int steps)
+{
+	for (int i = 0; i < steps; ++i)
+	{
+		co_await timer_awaiter{t};
+		lat.push_back(ns_since(t.fired));
+	}
+	co_return 0;
+}
+
+void timer_coroutine(vector<long>& lat, int chains, int steps)
+{
+	vector<chain_timer> timers(chains);
+	vector<task> tasks;
+	for (auto& t : timers)
+	{
+		uv_timer_init(uv_default_loop(), &t.timer);
+		t.timer.data = &t;
+		tasks.push_back(timer_coro_body(t, lat, steps));
+		tasks.back().h.resume();
+	}
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	for (auto& t : timers)
+		close_timer(t);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
+
+// one blocked worker thread per chain; the loop thread hands each expiry over
+// and waits until the worker asked for the next timer
+struct timer_worker
+{
+	chain_timer t;
+	mutex m;
+	condition_variable cv;
+	bool fired = false;
+	bool rearm = false;
+	bool done = false;
+};
+
+void timer_worker_cb(uv_timer_t* handle)
+{
+	auto* w = (timer_worker*)handle->data;
+	unique_lock<mutex> lk(w->m);
+	w->t.fired = bench_clock::now();
+	w->fired = true;
+	w->cv.notify_all();
+	w->cv.wait(lk, [&] { return w->rearm; });
+	w->rearm = false;
+	if (!w->done)
+		uv_timer_start(handle, timer_worker_cb, 0, 0);
+}
+
+void timer_thread(vector<long>& lat, int chains, int steps)
+{
+	vector<timer_worker> workers(chains);
+	vector<thread> threads;
+	mutex lat_mutex;
+	for (auto& w : workers)
+	{
+		uv_timer_init(uv_default_loop(), &w.t.timer);
+		w.t.timer.data = &w;
+		threads.emplace_back(
+			[&w, &lat, &lat_mutex, steps]
+			{
+				for (int i = 0; i < steps; ++i)
+				{
+					unique_lock<mutex> lk(w.m);
+					w.cv.wait(lk, [&] { return w.fired; });
+					w.fired = false;
+					{
+						lock_guard<mutex> g(lat_mutex);
+						lat.push_back(ns_since(w.t.fired));
+					}
+					w.done = i + 1 == steps;
+					w.rearm = true;
+					w.cv.notify_all();
+				}
+			});
+	}
+	for (auto& w : workers)
+	{
+		uv_timer_start(&w.t.timer, timer_worker_cb, 0, 0);
+	}
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+	for (auto& w : workers)
+		close_timer(w.t);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
+
+// ---- fan-out/fan-in: every node spawns `width` children and sums their results ----
+
+int tree_continuation_node(int depth, int width)
+{
+	if (0 == depth)
+	{
+		return 1;
+	}
+	vector<ctx::continuation> children;
+	for (int i = 0; i < width; ++i)
+	{
+		// each child suspends with its result, the parent joins them afterwards
+		children.push_back(ctx::callcc(std::allocator_arg, ctx::protected_fixedsize_stack(64 * 1024),
+									   [depth, width](ctx::continuation&& c)
+									   {
+										   c = c.resume(tree_continuation_node(depth - 1, width));
+										   return M__(c);
+									   }));
+	}
+	int sum = 1;
+	for (auto& c : children)
+	{
+		sum += c.get_data<int>();
+		c = c.resume();
+	}
+	return sum;
+}
+
+task tree_coro_node(int depth, int width)
+{
+	if (0 == depth)
+	{
+		co_return 1;
+	}
+	vector<task> children;
+	for (int i = 0; i < width; ++i)
+	{
+		children.push_back(tree_coro_node(depth - 1, width));
+	}
+	int sum = 1;
+	for (auto& c : children)
+	{
+		sum += co_await c;
+	}
+	co_return sum;
+}
+
+int tree_coroutine_node(int depth, int width)
+{
+	auto t = tree_coro_node(depth, width);
+	t.h.resume();
+	return t.h.promise().value;
+}
+
+int tree_thread_node(int depth, int width)
+{
+	if (0 == depth)
+	{
+		return 1;
+	}
+	vector<int> results(width);
+	vector<thread> children;
+	for (int i = 0; i < width; ++i)
+	{
+		children.emplace_back([&, i] { results[i] = tree_thread_node(depth - 1, width); });
+	}
+	for (auto& t : children)
+	{
+		t.join();
+	}
+	int sum = 1;
+	for (int r : results)
+	{
+		sum += r;
+	}
+	return sum;
+}
+
+template <class F>
+void tree(vector<long>& lat, int rounds, F&& node)
+{
+	for (int i = 0; i < rounds; ++i)
+	{
+		auto t0 = bench_clock::now();
+		node(5, 4);
+		lat.push_back(ns_since(t0));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int scale = argc > 1 ? max(1, atoi(argv[1])) : 1;
+
+	cout << left << setw(10) << "workload" << setw(14) << "impl" << right << setw(10) << "ops" << setw(14) << "ops/s"
+		 << setw(13) << "p50ns" << setw(13) << "p90ns" << setw(13) << "p99ns" << setw(15) << "maxns" << setw(11)
+		 << "peakKB" << setw(11) << "leftKB" << setw(9) << "nvcsw" << setw(9) << "nivcsw" << endl;
+
+	int n = 100000 * scale;
+	measure("generator", "continuation", [&](auto& lat) { gen_continuation(lat, n); });
+	measure("generator", "coroutine", [&](auto& lat) { gen_coroutine(lat, n); });
+	measure("generator", "thread", [&](auto& lat) { gen_thread(lat, n); });
+
+	int chains = 16, steps = 1000 * scale;
+	measure("timer", "continuation", [&](auto& lat) { timer_continuation(lat, chains, steps); });
+	measure("timer", "coroutine", [&](auto& lat) { timer_coroutine(lat, chains, steps); });
+	measure("timer", "thread", [&](auto& lat) { timer_thread(lat, chains, steps); });
+
+	int rounds = 20 * scale;
+	measure("tree", "continuation", [&](auto& lat) { tree(lat, rounds, tree_continuation_node); });
+	measure("tree", "coroutine", [&](auto& lat) { tree(lat, rounds, tree_coroutine_node); });
+	measure("tree", "thread", [&](auto& lat) { tree(lat, rounds, tree_thread_node); });
+
+	uv_loop_close(uv_default_loop());
+	return 0;
+}
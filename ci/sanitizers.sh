@@ -0,0 +1,17 @@
+#!/bin/sh
+# builds and runs the tests with each sanitizer, then once under valgrind
+# usage: ci/sanitizers.sh [variant...]   (address thread undefined valgrind)
+set -e
+cd "$(dirname "$0")/.."
+variants=${*:-address thread undefined valgrind}
+for variant in $variants; do
+	if [ valgrind = "$variant" ]; then
+		opts=-DCTX_VALGRIND=ON
+	else
+		opts=-DCTX_SANITIZER=$variant
+	fi
+	dir=_build-$variant
+	cmake -S . -B "$dir" $opts
+	cmake --build "$dir" -j"$(nproc)"
+	(cd "$dir" && ctest --output-on-failure)
+done
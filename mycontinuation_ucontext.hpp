@@ -1,18 +1,35 @@
 #pragma once
 
 #include <assert.h>
+#include <sched.h>
 #include <ucontext.h>
 
+#if defined(BOOST_USE_ASAN)
+#include <sanitizer/asan_interface.h>
+#endif
+#if defined(BOOST_USE_TSAN)
+#include <sanitizer/tsan_interface.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <functional>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <ostream>
+#include <stdexcept>
 #include <system_error>
 #include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_set>
 #include <utility>
 
 #define BOOST_ASSERT_MSG(expr, msg) assert((expr) && (msg))
@@ -24,8 +41,24 @@ struct stack_context
 {
 	std::size_t size{0};
 	void* sp{nullptr};
+#if defined(BOOST_USE_VALGRIND)
+	unsigned valgrind_stack_id{0};
+#endif
 };
 #include "myprotected_fixedsize_stack.hpp"
+#include "mystack_overflow.hpp"
+
+#if defined(CTX_PROFILE)
+#include "myprofile.hpp"
+// keep resume() out of line so its return address names the caller
+#define CTX_PROFILE_NOINLINE __attribute__((noinline))
+#define CTX_PROFILE_SITE()                                                                                             \
+	if (nullptr == profile::detail::thread_site())                                                                     \
+	profile::detail::thread_site() = __builtin_return_address(0)
+#else
+#define CTX_PROFILE_NOINLINE
+#define CTX_PROFILE_SITE()
+#endif
 
 namespace ctx
 {
@@ -40,11 +73,39 @@ static void entry_func(void* data) noexcept
 {
 	Record* record = static_cast<Record*>(data);
 	assert(nullptr != record);
+	// the switch away from `from` has completed, it may be resumed again
+	record->from->state.store(Record::state_suspended, std::memory_order_release);
+#if defined(BOOST_USE_ASAN)
+	// first switch into this stack; complete the one started by resume()
+	__sanitizer_finish_switch_fiber(record->fake_stack, (const void**)&record->from->stack_bottom,
+									&record->from->stack_size);
+#endif
+#if defined(CTX_PROFILE)
+	profile::detail::land();
+#endif
 	// start execution of toplevel context-function
 	record->run();
 }
 
+// slots for continuation_local<T> keys
+inline constexpr std::size_t local_slots = 16;
+inline void (*local_dtors[local_slots])(void*){};
+inline std::atomic<std::size_t> next_local_slot{0};
+
 struct activation_record;
+
+// contexts watched by ctx::stack_reclaimer; only filled while one exists
+struct idle_registry
+{
+	std::mutex mtx{};
+	std::unordered_set<activation_record*> records{};
+	std::atomic<std::size_t> reclaimers{0};
+	// advanced by stack_reclaimer::tick(), stamped on every suspended context
+	std::atomic<std::size_t> epoch{1};
+};
+
+inline idle_registry idle_contexts;
+
 struct activation_record_initializer
 {
 	inline thread_local static activation_record* current_rec;
@@ -60,10 +121,50 @@ struct activation_record
 	bool main_ctx{true};
 	activation_record* from{nullptr};
 	std::function<activation_record*(activation_record*&)> ontop{};
+	// transfer slots, filled by the resumer and consumed on wake-up
+	void* data{nullptr};
+#if !defined(NDEBUG)
+	// type of the tuple `data` points to, checked by get_data()
+	std::type_info const* data_type{nullptr};
+#endif
+	std::exception_ptr except{};
+	// non-null while the overflow handler tracks this stack
+	guard_entry* guard{nullptr};
+	// created on first use by this_continuation::arena(), dropped with the record
+	std::optional<std::pmr::monotonic_buffer_resource> arena{};
+	// continuation_local<T> values, constructed on first access
+	void* locals[local_slots]{};
 	bool terminated{false};
 	bool force_unwind{false};
+	// running while some thread executes on this context; set back to
+	// suspended by the context switched to, once the switch away has
+	// completed. busy: the stack reclaimer works on the suspended stack.
+	static constexpr std::uint8_t state_suspended = 0;
+	static constexpr std::uint8_t state_running = 1;
+	static constexpr std::uint8_t state_busy = 2;
+	std::atomic<std::uint8_t> state{state_running};
+	// idle_registry::epoch when this context was suspended
+	std::size_t idle_since{0};
+	// the dead part of the stack was released since the last suspension
+	bool stack_reclaimed{false};
+	bool idle_tracked{false};
+#if defined(BOOST_USE_ASAN)
+	void* fake_stack{nullptr};
+	void* stack_bottom{nullptr};
+	std::size_t stack_size{0};
+#endif
+#if defined(BOOST_USE_TSAN)
+	void* tsan_fiber{nullptr};
+	bool destroy_tsan_fiber{false};
+#endif
+#if defined(CTX_PROFILE)
+	// typeid name of the stack allocator, null for toplevel contexts
+	char const* salloc_name{nullptr};
+#endif
 
-	static activation_record*& current() noexcept
+	// not inlined: a context may be resumed on another thread, so the
+	// thread-local must be looked up again after every switch
+	__attribute__((noinline)) static activation_record*& current() noexcept
 	{
 		// initialized the first time control passes; per thread
 		thread_local static activation_record_initializer initializer;
@@ -78,13 +179,35 @@ struct activation_record
 		{
 			throw std::system_error(std::error_code(errno, std::system_category()), "getcontext() failed");
 		}
+#if defined(BOOST_USE_TSAN)
+		tsan_fiber = __tsan_get_current_fiber();
+#endif
 	}
 
-	activation_record(stack_context sctx_) noexcept : sctx(sctx_), main_ctx(false)
-	{}
+	activation_record(stack_context sctx_) noexcept : sctx(sctx_), main_ctx(false), state(state_suspended)
+	{
+#if defined(BOOST_USE_TSAN)
+		tsan_fiber = __tsan_create_fiber(0);
+		destroy_tsan_fiber = true;
+#endif
+	}
 
 	virtual ~activation_record()
-	{}
+	{
+		for (std::size_t i = 0; i < local_slots; ++i)
+		{
+			if ((nullptr != locals[i]))
+			{
+				local_dtors[i](locals[i]);
+			}
+		}
+#if defined(BOOST_USE_TSAN)
+		if ((destroy_tsan_fiber))
+		{
+			__tsan_destroy_fiber(tsan_fiber);
+		}
+#endif
+	}
 
 	activation_record(activation_record const&) = delete;
 	activation_record& operator=(activation_record const&) = delete;
@@ -94,27 +217,17 @@ struct activation_record
 		return main_ctx;
 	}
 
-	activation_record* resume()
+	activation_record* resume(void* data_ = nullptr)
 	{
-		from = current();
-		// store `this` in static, thread local pointer
-		// `this` will become the active (running) context
-		current() = this;
-
-		// context switch from parent context to `this`-context
-		::swapcontext(&from->uctx, &uctx);
-		return std::exchange(current()->from, nullptr);
+		data = data_;
+		return switch_context();
 	}
 
 	template <typename Ctx, typename Fn>
-	activation_record* resume_with(Fn&& fn)
+	activation_record* resume_with(Fn&& fn, void* data_ = nullptr)
 	{
-		from = current();
-		// store `this` in static, thread local pointer
-		// `this` will become the active (running) context
-		// returned by continuation::current()
-		current() = this;
-		current()->ontop = [fn = std::forward<Fn>(fn)](activation_record*& ptr)
+		data = data_;
+		ontop = [fn = std::forward<Fn>(fn)](activation_record*& ptr)
 		{
 			Ctx c{ptr};
 			c = fn(std::move(c));
@@ -124,9 +237,54 @@ struct activation_record
 			}
 			return std::exchange(c.ptr_, nullptr);
 		};
+		return switch_context();
+	}
+
+	activation_record* switch_context()
+	{
+		for (std::uint8_t expected = state_suspended;
+			 !state.compare_exchange_weak(expected, state_running, std::memory_order_acquire);
+			 expected = state_suspended)
+		{
+			if ((state_running == expected))
+			{
+				BOOST_ASSERT_MSG(false, "continuation resumed while running (resumed twice?)");
+				break;
+			}
+			// held by the stack reclaimer for the duration of one madvise()
+			if ((state_busy == expected))
+			{
+				::sched_yield();
+			}
+		}
+		from = current();
+		from->idle_since = idle_contexts.epoch.load(std::memory_order_relaxed);
+		from->stack_reclaimed = false;
+		// store `this` in static, thread local pointer
+		// `this` will become the active (running) context
+		// returned by continuation::current()
+		current() = this;
 
+#if defined(BOOST_USE_ASAN)
+		// a terminated context never comes back, its fake stack can go
+		__sanitizer_start_switch_fiber(from->terminated ? nullptr : &from->fake_stack, stack_bottom, stack_size);
+#endif
+#if defined(BOOST_USE_TSAN)
+		__tsan_switch_to_fiber(tsan_fiber, 0);
+#endif
+#if defined(CTX_PROFILE)
+		profile::detail::depart(force_unwind ? "unwind" : nullptr != ontop ? "resume_with" : "resume", salloc_name);
+#endif
 		// context switch from parent context to `this`-context
 		::swapcontext(&from->uctx, &uctx);
+#if defined(BOOST_USE_ASAN)
+		__sanitizer_finish_switch_fiber(current()->fake_stack, (const void**)&current()->from->stack_bottom,
+										&current()->from->stack_size);
+#endif
+#if defined(CTX_PROFILE)
+		profile::detail::land();
+#endif
+		current()->from->state.store(state_suspended, std::memory_order_release);
 		return std::exchange(current()->from, nullptr);
 	}
 
@@ -139,6 +297,11 @@ inline activation_record_initializer::activation_record_initializer() noexcept
 	if (0 == counter++)
 	{
 		current_rec = new activation_record();
+		// threads started after install_stack_overflow_handler() need their own
+		if ((overflow_handler_installed.load(std::memory_order_relaxed)))
+		{
+			ensure_alt_stack();
+		}
 	}
 }
 
@@ -180,8 +343,20 @@ class capture_record : public activation_record
 	{
 		typename std::decay<StackAlloc>::type salloc = std::move(p->salloc_);
 		stack_context sctx = p->sctx;
-		// deallocate activation record
+		deregister_guard(p->guard);
+		if ((p->idle_tracked))
+		{
+			std::lock_guard<std::mutex> lk{idle_contexts.mtx};
+			idle_contexts.records.erase(p);
+		}
+		// deallocate activation record, destroys the continuation_local values
+		// and releases all arena slabs at once
 		p->~capture_record();
+#if defined(BOOST_USE_ASAN)
+		// frames that never returned leave their scopes poisoned, a stack
+		// mapped at the same address later must start out clean
+		__asan_unpoison_memory_region(static_cast<char*>(sctx.sp) - sctx.size, sctx.size);
+#endif
 		// destroy stack with stack allocator
 		salloc.deallocate(sctx);
 	}
@@ -212,6 +387,16 @@ class capture_record : public activation_record
 			const_cast<forced_unwind&>(ex).caught = true;
 #endif
 		}
+		catch (...)
+		{
+			// nobody left to rethrow at
+			if ((!c))
+			{
+				std::terminate();
+			}
+			// rethrown at the resumer by continuation::resume()
+			c.ptr_->except = std::current_exception();
+		}
 		// this context has finished its task
 		from = nullptr;
 		ontop = nullptr;
@@ -223,10 +408,14 @@ class capture_record : public activation_record
 };
 
 template <typename Ctx, typename StackAlloc, typename Fn>
-static activation_record* create_context1(StackAlloc&& salloc, Fn&& fn)
+static activation_record* create_context1(StackAlloc&& salloc, Fn&& fn, source_site site)
 {
 	typedef capture_record<Ctx, StackAlloc, Fn> capture_t;
 
+#if defined(CTX_PROFILE)
+	char const* salloc_name = typeid(typename std::decay<StackAlloc>::type).name();
+	profile::scope prof{"create", site, salloc_name};
+#endif
 	auto sctx = salloc.allocate();
 	// reserve space for control structure
 	void* storage =
@@ -249,12 +438,48 @@ static activation_record* create_context1(StackAlloc&& salloc, Fn&& fn)
 	record->uctx.uc_stack.ss_size =
 		reinterpret_cast<uintptr_t>(storage) - reinterpret_cast<uintptr_t>(stack_bottom) - static_cast<uintptr_t>(64);
 	record->uctx.uc_link = nullptr;
+#if defined(BOOST_USE_ASAN)
+	record->stack_bottom = record->uctx.uc_stack.ss_sp;
+	record->stack_size = record->uctx.uc_stack.ss_size;
+#endif
 	::makecontext(&record->uctx, (void (*)()) & entry_func<capture_t>, 1, record);
+	record->guard = register_guard(sctx, record, site);
+	if ((0 != idle_contexts.reclaimers.load(std::memory_order_relaxed)))
+	{
+		std::lock_guard<std::mutex> lk{idle_contexts.mtx};
+		idle_contexts.records.insert(record);
+		record->idle_tracked = true;
+		record->idle_since = idle_contexts.epoch.load(std::memory_order_relaxed);
+	}
+#if defined(CTX_PROFILE)
+	record->salloc_name = salloc_name;
+#endif
 	return record;
 }
 
 } // namespace detail
 
+class continuation;
+
+template <typename StackAlloc, typename Fn>
+continuation callcc(std::allocator_arg_t, StackAlloc&&, Fn&&, source_site = source_site::current());
+
+namespace detail
+{
+
+// Executor::post(continuation&&) exists, see continuation::resume_on()
+template <typename Executor, typename = void>
+struct posts_continuations : std::false_type
+{};
+
+template <typename Executor>
+struct posts_continuations<Executor,
+						   std::void_t<decltype(std::declval<Executor&>().post(std::declval<continuation&&>()))>>
+	: std::true_type
+{};
+
+} // namespace detail
+
 class continuation
 {
   private:
@@ -264,16 +489,52 @@ class continuation
 	friend class detail::capture_record;
 
 	template <typename Ctx, typename StackAlloc, typename Fn>
-	friend detail::activation_record* detail::create_context1(StackAlloc&&, Fn&&);
+	friend detail::activation_record* detail::create_context1(StackAlloc&&, Fn&&, source_site);
 
 	template <typename StackAlloc, typename Fn>
-	friend continuation callcc(std::allocator_arg_t, StackAlloc&&, Fn&&);
+	friend continuation callcc(std::allocator_arg_t, StackAlloc&&, Fn&&, source_site);
 
 	detail::activation_record* ptr_{nullptr};
+	// payload passed along by the context `ptr_` refers to
+	void* data_{nullptr};
+#if !defined(NDEBUG)
+	std::type_info const* data_type_{nullptr};
+#endif
 
-	continuation(detail::activation_record* ptr) noexcept : ptr_{ptr}
+	continuation(detail::activation_record* ptr, void* data = nullptr) noexcept : ptr_{ptr}, data_{data}
 	{}
 
+	// called on the resumer's side once control came back
+	static continuation wake(detail::activation_record* ptr)
+	{
+		detail::activation_record* current = detail::activation_record::current();
+		if ((current->force_unwind))
+		{
+			throw detail::forced_unwind{ptr};
+		}
+		else if ((nullptr != current->except))
+		{
+			// `ptr` has terminated, released while the exception propagates
+			continuation c{ptr};
+			std::rethrow_exception(std::exchange(current->except, nullptr));
+		}
+		void* data = std::exchange(current->data, nullptr);
+#if !defined(NDEBUG)
+		std::type_info const* data_type = std::exchange(current->data_type, nullptr);
+#endif
+		if ((nullptr != current->ontop))
+		{
+			// the function may resume_with() again, which assigns a new one
+			auto fn = std::exchange(current->ontop, nullptr);
+			ptr = fn(ptr);
+		}
+		continuation c{ptr, data};
+#if !defined(NDEBUG)
+		c.data_type_ = data_type;
+#endif
+		return c;
+	}
+
   public:
 	continuation() = default;
 
@@ -309,46 +570,91 @@ class continuation
 		return *this;
 	}
 
-	continuation resume() &
+	// arguments are moved into a tuple living on this side's stack;
+	// the other side must fetch them with get_data() before resuming us
+	template <typename... Arg>
+	CTX_PROFILE_NOINLINE continuation resume(Arg&&... arg) &
 	{
-		return std::move(*this).resume();
+		CTX_PROFILE_SITE();
+		return std::move(*this).resume(std::forward<Arg>(arg)...);
 	}
 
-	continuation resume() &&
+	template <typename... Arg>
+	CTX_PROFILE_NOINLINE continuation resume(Arg&&... arg) &&
 	{
-		detail::activation_record* ptr = std::exchange(ptr_, nullptr)->resume();
-		if ((detail::activation_record::current()->force_unwind))
+		CTX_PROFILE_SITE();
+		std::tuple<typename std::decay<Arg>::type...> data{std::forward<Arg>(arg)...};
+#if !defined(NDEBUG)
+		ptr_->data_type = &typeid(data);
+#endif
+		return wake(std::exchange(ptr_, nullptr)->resume(0 != sizeof...(Arg) ? &data : nullptr));
+	}
+
+	template <typename Fn, typename... Arg>
+	CTX_PROFILE_NOINLINE continuation resume_with(Fn&& fn, Arg&&... arg) &
+	{
+		CTX_PROFILE_SITE();
+		return std::move(*this).resume_with(std::forward<Fn>(fn), std::forward<Arg>(arg)...);
+	}
+
+	template <typename Fn, typename... Arg>
+	CTX_PROFILE_NOINLINE continuation resume_with(Fn&& fn, Arg&&... arg) &&
+	{
+		CTX_PROFILE_SITE();
+		std::tuple<typename std::decay<Arg>::type...> data{std::forward<Arg>(arg)...};
+#if !defined(NDEBUG)
+		ptr_->data_type = &typeid(data);
+#endif
+		return wake(std::exchange(ptr_, nullptr)->resume_with<continuation>(std::forward<Fn>(fn),
+																		   0 != sizeof...(Arg) ? &data : nullptr));
+	}
+
+	// hands this continuation to `ex`, which resumes it on its own thread(s);
+	// Executor needs post(std::function<void()>), or post(continuation&&)
+	// returning false while it is full (mpmc_executor), which is retried.
+	// A context moves itself with
+	//   park(c, [&ex](continuation&& self) { std::move(self).resume_on(ex); });
+	template <typename Executor>
+	void resume_on(Executor& ex) &&
+	{
+		BOOST_ASSERT_MSG(nullptr != ptr_, "resume_on() of an empty continuation");
+		if constexpr (detail::posts_continuations<Executor>::value)
 		{
-			throw detail::forced_unwind{ptr};
+			while (!ex.post(std::move(*this)))
+			{
+				::sched_yield();
+			}
 		}
-		else if ((nullptr != detail::activation_record::current()->ontop))
+		else
 		{
-			ptr = detail::activation_record::current()->ontop(ptr);
-			detail::activation_record::current()->ontop = nullptr;
+			ex.post([c = std::make_shared<continuation>(std::move(*this))]() { c->resume(); });
 		}
-		return {ptr};
 	}
 
-	template <typename Fn>
-	continuation resume_with(Fn&& fn) &
+	bool data_available() const noexcept
 	{
-		return std::move(*this).resume_with(std::forward<Fn>(fn));
+		return nullptr != data_;
 	}
 
-	template <typename Fn>
-	continuation resume_with(Fn&& fn) &&
+	// Arg... must match the (decayed) types passed to resume(), checked in
+	// debug builds
+	template <typename... Arg>
+	auto get_data()
 	{
-		detail::activation_record* ptr = std::exchange(ptr_, nullptr)->resume_with<continuation>(std::forward<Fn>(fn));
-		if ((detail::activation_record::current()->force_unwind))
+		BOOST_ASSERT_MSG(data_available(), "no data transferred");
+#if !defined(NDEBUG)
+		BOOST_ASSERT_MSG(typeid(std::tuple<Arg...>) == *std::exchange(data_type_, nullptr),
+						 "get_data() types differ from the ones passed to resume()");
+#endif
+		auto* data = static_cast<std::tuple<Arg...>*>(std::exchange(data_, nullptr));
+		if constexpr (1 == sizeof...(Arg))
 		{
-			throw detail::forced_unwind{ptr};
+			return std::move(std::get<0>(*data));
 		}
-		else if ((nullptr != detail::activation_record::current()->ontop))
+		else
 		{
-			ptr = detail::activation_record::current()->ontop(ptr);
-			detail::activation_record::current()->ontop = nullptr;
+			return std::move(*data);
 		}
-		return {ptr};
 	}
 
 	explicit operator bool() const noexcept
@@ -383,22 +689,121 @@ class continuation
 	void swap(continuation& other) noexcept
 	{
 		std::swap(ptr_, other.ptr_);
+		std::swap(data_, other.data_);
+#if !defined(NDEBUG)
+		std::swap(data_type_, other.data_type_);
+#endif
 	}
 };
 
 template <typename Fn, typename = disable_overload<continuation, Fn>>
-continuation callcc(Fn&& fn)
+continuation callcc(Fn&& fn, source_site site = source_site::current())
 {
-	return callcc(std::allocator_arg, protected_fixedsize_stack(4 * 1024 * 1024), std::forward<Fn>(fn));
+	return callcc(std::allocator_arg, protected_fixedsize_stack(4 * 1024 * 1024), std::forward<Fn>(fn), site);
 }
 
 template <typename StackAlloc, typename Fn>
-continuation callcc(std::allocator_arg_t, StackAlloc&& salloc, Fn&& fn)
+continuation callcc(std::allocator_arg_t, StackAlloc&& salloc, Fn&& fn, source_site site)
 {
-	return continuation{detail::create_context1<continuation>(std::forward<StackAlloc>(salloc), std::forward<Fn>(fn))}
+	return continuation{detail::create_context1<continuation>(std::forward<StackAlloc>(salloc), std::forward<Fn>(fn),
+															  site)}
 		.resume();
 }
 
+// suspends the calling context (`c`: the continuation it was resumed with)
+// and hands its own continuation to `keep`, which runs on the context
+// switched to, e.g. [&w](continuation&& self) { w = std::move(self); }.
+// `keep` may instead return a continuation to switch to, e.g.
+// std::move(self).resume() if the awaited event happened in the meantime.
+//
+// whoever resumes a parked context drops whatever it switches back with, so
+// a parked context should only suspend through park() or run to completion
+template <typename Keep>
+void park(continuation& c, Keep keep)
+{
+	c = c.resume_with(
+		[keep = std::move(keep)](continuation&& self)
+		{
+			if constexpr (std::is_void<decltype(keep(std::move(self)))>::value)
+			{
+				keep(std::move(self));
+				return continuation{};
+			}
+			else
+			{
+				return continuation{keep(std::move(self))};
+			}
+		});
+}
+
+namespace this_continuation
+{
+
+// bump allocator living as long as the running context; individual
+// deallocations are no-ops, everything is freed when the context is
+// destroyed (for the main context: at thread exit). Memory taken from it
+// must not outlive the context, e.g. std::pmr::string s{arena()}
+inline std::pmr::memory_resource* arena()
+{
+	detail::activation_record* current = detail::activation_record::current();
+	if ((!current->arena))
+	{
+		current->arena.emplace(1024);
+	}
+	return &*current->arena;
+}
+
+} // namespace this_continuation
+
+// per-context counterpart of thread_local: every context (including each
+// thread's main context) sees its own T, default-constructed on first access
+// and destroyed with the context. Keys are meant to be long-lived (static);
+// their slots are never reused, at most detail::local_slots may exist.
+template <typename T>
+class continuation_local
+{
+  private:
+	std::size_t index_;
+
+	static void destroy(void* p) noexcept
+	{
+		delete static_cast<T*>(p);
+	}
+
+  public:
+	continuation_local() : index_{detail::next_local_slot.fetch_add(1)}
+	{
+		if ((detail::local_slots <= index_))
+		{
+			throw std::length_error("continuation_local: out of slots");
+		}
+		detail::local_dtors[index_] = &destroy;
+	}
+
+	continuation_local(continuation_local const&) = delete;
+	continuation_local& operator=(continuation_local const&) = delete;
+
+	T& get()
+	{
+		void*& p = detail::activation_record::current()->locals[index_];
+		if ((nullptr == p))
+		{
+			p = new T();
+		}
+		return *static_cast<T*>(p);
+	}
+
+	T& operator*()
+	{
+		return get();
+	}
+
+	T* operator->()
+	{
+		return &get();
+	}
+};
+
 inline void swap(continuation& l, continuation& r) noexcept
 {
 	l.swap(r);
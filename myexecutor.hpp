@@ -0,0 +1,311 @@
+#pragma once
+
+extern "C"
+{
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mycontinuation_ucontext.hpp"
+
+namespace ctx
+{
+namespace detail
+{
+
+inline constexpr std::size_t cacheline_size = 64;
+
+// bounded multi-producer/multi-consumer queue (D. Vyukov): one CAS per
+// operation, every cell on its own cache line, FIFO per producer
+template <typename T>
+class mpmc_queue
+{
+  private:
+	struct alignas(cacheline_size) cell
+	{
+		std::atomic<std::size_t> seq;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	cell* cells_;
+	std::size_t mask_;
+	alignas(cacheline_size) std::atomic<std::size_t> enqueue_pos_{0};
+	alignas(cacheline_size) std::atomic<std::size_t> dequeue_pos_{0};
+
+  public:
+	// capacity must be a power of two
+	explicit mpmc_queue(std::size_t capacity) : cells_{new cell[capacity]}, mask_{capacity - 1}
+	{
+		if ((capacity < 2 || 0 != (capacity & mask_)))
+		{
+			delete[] cells_;
+			throw std::invalid_argument("mpmc_queue: capacity must be a power of two");
+		}
+		for (std::size_t i = 0; i < capacity; ++i)
+		{
+			cells_[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~mpmc_queue()
+	{
+		T v;
+		while (pop(v))
+		{}
+		delete[] cells_;
+	}
+
+	mpmc_queue(mpmc_queue const&) = delete;
+	mpmc_queue& operator=(mpmc_queue const&) = delete;
+
+	// false if full, `v` is left untouched then
+	bool push(T&& v)
+	{
+		cell* c;
+		std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			c = &cells_[pos & mask_];
+			std::size_t seq = c->seq.load(std::memory_order_acquire);
+			std::intptr_t dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+			if ((0 == dif))
+			{
+				if ((enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)))
+				{
+					break;
+				}
+			}
+			else if ((0 > dif))
+			{
+				return false;
+			}
+			else
+			{
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+		new (c->storage) T(std::move(v));
+		c->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& v)
+	{
+		cell* c;
+		std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			c = &cells_[pos & mask_];
+			std::size_t seq = c->seq.load(std::memory_order_acquire);
+			std::intptr_t dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+			if ((0 == dif))
+			{
+				if ((dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)))
+				{
+					break;
+				}
+			}
+			else if ((0 > dif))
+			{
+				return false;
+			}
+			else
+			{
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+		T* p = std::launder(reinterpret_cast<T*>(c->storage));
+		v = std::move(*p);
+		p->~T();
+		c->seq.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+inline void futex_wait(std::atomic<uint32_t>* addr, uint32_t expected) noexcept
+{
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>* addr, int n) noexcept
+{
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+}
+
+} // namespace detail
+
+// run-to-completion executor: N threads drain one shared FIFO of suspended
+// continuations. A worker resumes up to `batch` of them, then calls `poll`
+// (e.g. a non-blocking I/O poll), then goes on. Every worker calls `poll`,
+// possibly at the same time: it has to be thread-safe. Idle workers spin,
+// yield and finally sleep on a futex until post() wakes them.
+//
+// a resumed context has to park itself again (yield(), or ctx::park()) or
+// run to completion. Size the queue for all contexts that may be queued at
+// once, yield() spins while it is full.
+class mpmc_executor
+{
+  private:
+	detail::mpmc_queue<continuation> queue_;
+	std::size_t batch_;
+	std::function<void()> poll_;
+	std::vector<std::thread> threads_{};
+	std::atomic<bool> stop_{false};
+	alignas(detail::cacheline_size) std::atomic<uint32_t> epoch_{0};
+	std::atomic<uint32_t> sleepers_{0};
+
+	void wake_one() noexcept
+	{
+		// an RMW reads the latest sleepers_; pairs with the fetch_add() in
+		// idle(): either we see the sleeper, or it sees the push when it
+		// re-checks the queue
+		if ((0 != sleepers_.fetch_add(0, std::memory_order_seq_cst)))
+		{
+			epoch_.fetch_add(1, std::memory_order_seq_cst);
+			detail::futex_wake(&epoch_, 1);
+		}
+	}
+
+	void idle(unsigned& rounds)
+	{
+		if ((++rounds < 64))
+		{
+			detail::cpu_relax();
+			return;
+		}
+		if ((rounds < 80))
+		{
+			std::this_thread::yield();
+			return;
+		}
+		rounds = 0;
+		uint32_t e = epoch_.load(std::memory_order_seq_cst);
+		sleepers_.fetch_add(1, std::memory_order_seq_cst);
+		// re-check after announcing ourselves, post() might have missed us
+		continuation c;
+		if ((queue_.pop(c)))
+		{
+			sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+			std::move(c).resume();
+			return;
+		}
+		if ((!stop_.load(std::memory_order_acquire)))
+		{
+			detail::futex_wait(&epoch_, e);
+		}
+		sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+	}
+
+	void work(std::size_t index, bool pin)
+	{
+		if ((pin))
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &set);
+			::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+		}
+		unsigned rounds = 0;
+		while (!stop_.load(std::memory_order_acquire))
+		{
+			std::size_t n = 0;
+			continuation c;
+			while (n < batch_ && queue_.pop(c))
+			{
+				std::move(c).resume();
+				++n;
+			}
+			if ((poll_))
+			{
+				poll_();
+			}
+			if ((0 != n))
+			{
+				rounds = 0;
+			}
+			else
+			{
+				idle(rounds);
+			}
+		}
+	}
+
+  public:
+	// capacity: power of two; pin: bind worker i to CPU i
+	explicit mpmc_executor(std::size_t threads, std::size_t capacity = 4096, std::size_t batch = 64,
+						   bool pin = false, std::function<void()> poll = {})
+		: queue_{capacity}, batch_{batch}, poll_{std::move(poll)}
+	{
+		threads_.reserve(threads);
+		for (std::size_t i = 0; i < threads; ++i)
+		{
+			threads_.emplace_back([this, i, pin] { work(i, pin); });
+		}
+	}
+
+	// contexts still queued are force-unwound by the queue's destructor
+	~mpmc_executor()
+	{
+		stop_.store(true, std::memory_order_release);
+		epoch_.fetch_add(1, std::memory_order_seq_cst);
+		detail::futex_wake(&epoch_, INT_MAX);
+		for (auto& t : threads_)
+		{
+			t.join();
+		}
+	}
+
+	mpmc_executor(mpmc_executor const&) = delete;
+	mpmc_executor& operator=(mpmc_executor const&) = delete;
+
+	// false if the queue is full, `c` stays with the caller then
+	bool post(continuation&& c)
+	{
+		if ((!queue_.push(std::move(c))))
+		{
+			return false;
+		}
+		wake_one();
+		return true;
+	}
+
+	// moves the calling context (`c`: the continuation it was resumed with)
+	// to the back of the queue; the same call moves a context onto the executor
+	void yield(continuation& c)
+	{
+		park(c,
+			 [this](continuation&& self)
+			 {
+				 while (!post(std::move(self)))
+				 {
+					 std::this_thread::yield();
+				 }
+			 });
+	}
+};
+
+} // namespace ctx
@@ -0,0 +1,351 @@
+#pragma once
+
+// hardware counters around context creation and switches, built with -DCTX_PROFILE
+//
+// every switch is measured from just before swapcontext() to the first
+// instruction on the other side, on the same thread, so only the switch
+// itself is counted. Samples are aggregated per (operation, call site,
+// stack allocator) and printed to stderr at exit, or by profile::report().
+
+extern "C"
+{
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace ctx
+{
+namespace profile
+{
+
+inline constexpr std::size_t event_count = 7;
+
+struct event_desc
+{
+	char const* name;
+	uint32_t type;
+	uint64_t config;
+};
+
+// generic perf events; there is no generic L2 event, the last level cache stands in
+inline constexpr event_desc events[event_count] = {
+	{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{"instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{"l1d-miss", PERF_TYPE_HW_CACHE,
+	 PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{"llc-miss", PERF_TYPE_HW_CACHE,
+	 PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{"dtlb-miss", PERF_TYPE_HW_CACHE,
+	 PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	// available without a PMU (VMs, containers)
+	{"task-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+struct sample
+{
+	uint64_t v[event_count]{};
+};
+
+struct totals
+{
+	uint64_t count{0};
+	uint64_t sum[event_count]{};
+};
+
+namespace detail
+{
+
+// one counter group per thread, user space only
+struct counters
+{
+	int leader{-1};
+	int fds[event_count];
+	// position of each event in the group read, -1 if it could not be opened
+	int slot[event_count];
+	int opened{0};
+
+	counters() noexcept
+	{
+		for (std::size_t i = 0; i < event_count; ++i)
+		{
+			perf_event_attr attr{};
+			attr.size = sizeof(attr);
+			attr.type = events[i].type;
+			attr.config = events[i].config;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+			int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+			slot[i] = -1;
+			if ((0 > fd))
+			{
+				continue;
+			}
+			if ((-1 == leader))
+			{
+				leader = fd;
+			}
+			fds[opened] = fd;
+			slot[i] = opened++;
+		}
+		if ((-1 != leader))
+		{
+			::ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	~counters()
+	{
+		for (int i = 0; i < opened; ++i)
+		{
+			::close(fds[i]);
+		}
+	}
+
+	bool read(sample& s) noexcept
+	{
+		uint64_t buf[1 + event_count];
+		if ((-1 == leader || 0 >= ::read(leader, buf, sizeof(buf))))
+		{
+			return false;
+		}
+		for (std::size_t i = 0; i < event_count; ++i)
+		{
+			s.v[i] = 0 <= slot[i] ? buf[1 + slot[i]] : 0;
+		}
+		return true;
+	}
+};
+
+// key: operation, call site (return address or file and line), stack allocator
+using key = std::tuple<char const*, void const*, char const*, int, char const*>;
+
+struct registry
+{
+	std::mutex mtx{};
+	std::map<key, totals> table{};
+	// some thread failed to open any counter
+	std::atomic<bool> unavailable{false};
+
+	~registry()
+	{
+		if ((nullptr == std::getenv("CTX_PROFILE_QUIET")))
+		{
+			print(std::cerr);
+		}
+	}
+
+	void print(std::ostream& os);
+};
+
+inline registry& global()
+{
+	static registry r;
+	return r;
+}
+
+inline counters& thread_counters()
+{
+	thread_local static counters c;
+	thread_local static bool checked = false;
+	if ((!std::exchange(checked, true) && -1 == c.leader))
+	{
+		global().unavailable = true;
+	}
+	return c;
+}
+
+inline void record(key const& k, sample const& before, sample const& after)
+{
+	registry& r = global();
+	std::lock_guard<std::mutex> lk{r.mtx};
+	totals& t = r.table[k];
+	++t.count;
+	for (std::size_t i = 0; i < event_count; ++i)
+	{
+		t.sum[i] += after.v[i] - before.v[i];
+	}
+}
+
+// a switch in flight on this thread
+struct pending
+{
+	bool armed{false};
+	char const* op{nullptr};
+	void const* site{nullptr};
+	char const* salloc{nullptr};
+	sample before{};
+};
+
+inline pending& thread_pending()
+{
+	thread_local static pending p;
+	return p;
+}
+
+// set by continuation::resume()/resume_with(), consumed by depart()
+inline void const*& thread_site()
+{
+	thread_local static void const* site = nullptr;
+	return site;
+}
+
+// templates and paths make for long names, keep the tail
+inline std::string tail(std::string s)
+{
+	return s.size() > 60 ? "..." + s.substr(s.size() - 57) : s;
+}
+
+inline std::string symbolize(void const* addr)
+{
+	std::ostringstream os;
+	Dl_info info{};
+	if ((0 == ::dladdr(addr, &info)))
+	{
+		os << addr;
+	}
+	else if ((nullptr != info.dli_sname))
+	{
+		int status = 0;
+		char* name = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+		std::string s = 0 == status ? name : info.dli_sname;
+		std::free(name);
+		os << tail(std::move(s)) << "+0x" << std::hex
+		   << (reinterpret_cast<uintptr_t>(addr) - reinterpret_cast<uintptr_t>(info.dli_saddr));
+	}
+	else
+	{
+		// not exported (static, or an executable linked without -rdynamic):
+		// the offset into the module, as addr2line takes it
+		os << tail(info.dli_fname) << "+0x" << std::hex
+		   << (reinterpret_cast<uintptr_t>(addr) - reinterpret_cast<uintptr_t>(info.dli_fbase));
+	}
+	return os.str();
+}
+
+inline std::string demangle(char const* name)
+{
+	int status = 0;
+	char* s = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+	std::string r = 0 == status ? s : name;
+	std::free(s);
+	return r;
+}
+
+inline void registry::print(std::ostream& os)
+{
+	std::lock_guard<std::mutex> lk{mtx};
+	if ((unavailable))
+	{
+		os << "ctx profile: perf_event_open() failed on some thread (check kernel.perf_event_paranoid)\n";
+	}
+	if ((table.empty()))
+	{
+		return;
+	}
+	os << "ctx profile: mean per operation, user space only, 0 = event not available\n";
+	os << std::left << std::setw(12) << "op" << std::setw(72) << "site" << std::right << std::setw(10) << "count";
+	for (auto const& e : events)
+	{
+		os << std::setw(11) << e.name;
+	}
+	os << "\n";
+	for (auto const& [k, t] : table)
+	{
+		// <module>+0x<offset> sites: addr2line -e <module> -f -C <offset>
+		std::string site = "?";
+		if ((nullptr != std::get<1>(k)))
+		{
+			site = symbolize(std::get<1>(k));
+		}
+		else if ((nullptr != std::get<2>(k)))
+		{
+			site = std::string{std::get<2>(k)} + ":" + std::to_string(std::get<3>(k));
+		}
+		os << std::left << std::setw(12) << std::get<0>(k) << std::setw(72) << site << std::right << std::setw(10)
+		   << t.count;
+		for (std::size_t i = 0; i < event_count; ++i)
+		{
+			os << std::setw(11) << t.sum[i] / t.count;
+		}
+		os << "\n" << std::setw(12) << "" << "  stack: " << demangle(std::get<4>(k)) << "\n";
+	}
+}
+
+// before swapcontext(); salloc: allocator of the context switched to
+inline void depart(char const* op, char const* salloc) noexcept
+{
+	pending& p = thread_pending();
+	p.op = op;
+	p.site = std::exchange(thread_site(), nullptr);
+	p.salloc = nullptr != salloc ? salloc : "main";
+	p.armed = thread_counters().read(p.before);
+}
+
+// first thing on the other side of swapcontext()
+inline void land()
+{
+	pending& p = thread_pending();
+	sample after;
+	if ((!std::exchange(p.armed, false) || !thread_counters().read(after)))
+	{
+		return;
+	}
+	record(key{p.op, p.site, nullptr, 0, p.salloc}, p.before, after);
+}
+
+} // namespace detail
+
+// prints the aggregated counters collected so far
+inline void report(std::ostream& os)
+{
+	detail::global().print(os);
+}
+
+// measures a scope, used for context creation
+class scope
+{
+  private:
+	char const* op_;
+	source_site site_;
+	char const* salloc_;
+	sample before_{};
+	bool armed_;
+
+  public:
+	scope(char const* op, source_site site, char const* salloc)
+		: op_{op}, site_{site}, salloc_{salloc}, armed_{detail::thread_counters().read(before_)}
+	{}
+
+	~scope()
+	{
+		sample after;
+		if ((armed_ && detail::thread_counters().read(after)))
+		{
+			detail::record(detail::key{op_, nullptr, site_.file, site_.line, salloc_}, before_, after);
+		}
+	}
+};
+
+} // namespace profile
+} // namespace ctx
@@ -12,6 +12,10 @@ extern "C"
 #include <unistd.h>
 }
 
+#if defined(BOOST_USE_VALGRIND)
+#include <valgrind/valgrind.h>
+#endif
+
 #include <cmath>
 #include <cstddef>
 #include <new>
@@ -108,11 +112,19 @@ class basic_protected_fixedsize_stack
 
 			// conforming to POSIX.1-2001
 		const int result(::mprotect(vp, traits_type::page_size(), PROT_NONE));
-		assert(0 == result);
+		// the guard page splits the mapping in two, fails once vm.max_map_count is reached
+		if (0 != result)
+		{
+			::munmap(vp, size__);
+			throw std::bad_alloc();
+		}
 
 		stack_context sctx;
 		sctx.size = size__;
 		sctx.sp = static_cast<char*>(vp) + sctx.size;
+#if defined(BOOST_USE_VALGRIND)
+		sctx.valgrind_stack_id = VALGRIND_STACK_REGISTER(sctx.sp, vp);
+#endif
 		return sctx;
 	}
 
@@ -120,6 +132,9 @@ class basic_protected_fixedsize_stack
 	{
 		assert(sctx.sp);
 
+#if defined(BOOST_USE_VALGRIND)
+		VALGRIND_STACK_DEREGISTER(sctx.valgrind_stack_id);
+#endif
 		void* vp = static_cast<char*>(sctx.sp) - sctx.size;
 		// conform to POSIX.4 (POSIX.1b-1993, _POSIX_C_SOURCE=199309L)
 		::munmap(vp, sctx.size);
@@ -0,0 +1,177 @@
+#pragma once
+
+extern "C"
+{
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "mycontinuation_ucontext.hpp"
+
+#if !defined(MADV_PAGEOUT)
+#define MADV_PAGEOUT 21
+#endif
+
+namespace ctx
+{
+
+struct reclaim_stats
+{
+	// contexts looked at, and those suspended long enough
+	std::size_t scanned{0};
+	std::size_t idle{0};
+	// resident bytes below the stack pointers handed back to the kernel
+	std::size_t released{0};
+	// resident bytes of live stack frames pushed to swap (mode::pageout)
+	std::size_t paged_out{0};
+};
+
+// hands back the memory of context stacks that stay suspended for long
+//
+// everything below a suspended context's stack pointer is dead, those
+// pages are dropped with madvise(MADV_DONTNEED); the kernel maps zero pages
+// again once the context grows its stack after being resumed. With
+// mode::pageout the live frames are additionally pushed out with
+// MADV_PAGEOUT (Linux 5.4+, compressed if zswap is enabled) and fault back
+// in on resume.
+//
+// only contexts created while a reclaimer exists are tracked. tick() may be
+// called from any thread, e.g. from a periodic uv timer; a context resumed
+// while its stack is being worked on waits until that stack is done.
+class stack_reclaimer
+{
+  public:
+	enum class mode
+	{
+		release,
+		pageout
+	};
+
+  private:
+	mode mode_;
+	std::size_t page_size_{static_cast<std::size_t>(::sysconf(_SC_PAGESIZE))};
+	std::vector<unsigned char> residency_{};
+	std::size_t total_{0};
+
+	static uintptr_t saved_sp(ucontext_t const& uctx) noexcept
+	{
+#if defined(__x86_64__)
+		// skip the red zone, the leaf function may keep data in it
+		return static_cast<uintptr_t>(uctx.uc_mcontext.gregs[REG_RSP]) - 128;
+#elif defined(__aarch64__)
+		return static_cast<uintptr_t>(uctx.uc_mcontext.sp);
+#else
+		return 0;
+#endif
+	}
+
+	std::size_t resident(uintptr_t begin, uintptr_t end)
+	{
+		std::size_t pages = (end - begin) / page_size_;
+		residency_.resize(pages);
+		if ((0 != ::mincore(reinterpret_cast<void*>(begin), end - begin, residency_.data())))
+		{
+			return 0;
+		}
+		std::size_t n = 0;
+		for (unsigned char r : residency_)
+		{
+			n += r & 1;
+		}
+		return n * page_size_;
+	}
+
+	// [begin, end) rounded inwards to whole pages
+	std::size_t advise(uintptr_t begin, uintptr_t end, int advice)
+	{
+		begin = (begin + page_size_ - 1) & ~(page_size_ - 1);
+		end &= ~(page_size_ - 1);
+		if ((begin >= end))
+		{
+			return 0;
+		}
+		std::size_t before = resident(begin, end);
+		if ((0 == before || 0 != ::madvise(reinterpret_cast<void*>(begin), end - begin, advice)))
+		{
+			return 0;
+		}
+		// MADV_PAGEOUT leaves pages alone that cannot be swapped
+		std::size_t after = resident(begin, end);
+		return before > after ? before - after : 0;
+	}
+
+	void reclaim(detail::activation_record* rec, reclaim_stats& stats)
+	{
+		uintptr_t sp = saved_sp(rec->uctx);
+		uintptr_t top = reinterpret_cast<uintptr_t>(rec->sctx.sp);
+		uintptr_t bottom = top - rec->sctx.size;
+		if ((sp <= bottom || sp >= top))
+		{
+			return;
+		}
+		stats.released += advise(bottom, sp, MADV_DONTNEED);
+		if ((mode::pageout == mode_))
+		{
+			// the record sits at the top of the stack and is read on every tick
+			stats.paged_out += advise(sp, reinterpret_cast<uintptr_t>(rec), MADV_PAGEOUT);
+		}
+	}
+
+  public:
+	explicit stack_reclaimer(mode m = mode::release) noexcept : mode_{m}
+	{
+		detail::idle_contexts.reclaimers.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// contexts already tracked stay tracked until they are destroyed
+	~stack_reclaimer()
+	{
+		detail::idle_contexts.reclaimers.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	stack_reclaimer(stack_reclaimer const&) = delete;
+	stack_reclaimer& operator=(stack_reclaimer const&) = delete;
+
+	// starts a new interval and reclaims every context that stayed suspended
+	// for at least `idle_ticks` full intervals; a stack is reclaimed once
+	// per suspension
+	reclaim_stats tick(std::size_t idle_ticks = 1)
+	{
+		using record = detail::activation_record;
+		reclaim_stats stats;
+		std::size_t now = detail::idle_contexts.epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+		std::lock_guard<std::mutex> lk{detail::idle_contexts.mtx};
+		for (record* rec : detail::idle_contexts.records)
+		{
+			++stats.scanned;
+			std::uint8_t expected = record::state_suspended;
+			if ((!rec->state.compare_exchange_strong(expected, record::state_busy, std::memory_order_acquire)))
+			{
+				continue;
+			}
+			if ((!rec->terminated && !rec->stack_reclaimed && now - rec->idle_since > idle_ticks))
+			{
+				++stats.idle;
+				reclaim(rec, stats);
+				rec->stack_reclaimed = true;
+			}
+			rec->state.store(record::state_suspended, std::memory_order_release);
+		}
+		total_ += stats.released + stats.paged_out;
+		return stats;
+	}
+
+	// bytes released and paged out over all ticks
+	std::size_t total() const noexcept
+	{
+		return total_;
+	}
+};
+
+} // namespace ctx
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <random>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "mycontinuation_ucontext.hpp"
+
+namespace ctx
+{
+namespace sim
+{
+
+using duration = std::chrono::nanoseconds;
+
+class scheduler;
+
+// draws the latency of one simulated operation
+using latency = std::function<duration(scheduler&)>;
+
+// single-threaded discrete event scheduler on a virtual clock
+//
+// stands in for libuv: timers, contexts and simulated I/O are events on one
+// queue, run in virtual time order; run() jumps the clock from event to
+// event, so an hour of traffic takes as long as the code it runs. Events
+// due at the same instant run in an order drawn from the seed, a run is
+// replayed exactly by the same seed (see trace()). All randomness comes from
+// the seeded mt19937_64 and is transformed here, not by <random>'s
+// distributions, whose results differ between standard libraries.
+//
+// contexts park() in sleep()/io() and are resumed by the scheduler, so they
+// should only suspend through those or run to completion. An exception
+// escaping a context propagates out of run().
+class scheduler
+{
+  private:
+	struct event
+	{
+		duration at;
+		// breaks ties between events due at the same instant
+		uint64_t order;
+		uint64_t seq;
+		std::function<void()> fn;
+		continuation c;
+	};
+
+	struct later
+	{
+		bool operator()(event const& l, event const& r) const noexcept
+		{
+			if ((l.at != r.at))
+			{
+				return l.at > r.at;
+			}
+			if ((l.order != r.order))
+			{
+				return l.order > r.order;
+			}
+			return l.seq > r.seq;
+		}
+	};
+
+	uint64_t seed_;
+	std::mt19937_64 rng_;
+	duration now_{0};
+	uint64_t seq_{0};
+	uint64_t trace_{14695981039346656037ull};
+	double fault_rate_{0.0};
+	std::vector<event> queue_{};
+
+	void push(duration delay, std::function<void()> fn, continuation c)
+	{
+		queue_.push_back(event{now_ + delay, rng_(), seq_++, std::move(fn), std::move(c)});
+		std::push_heap(queue_.begin(), queue_.end(), later{});
+	}
+
+	// FNV-1a over the sequence of events run
+	void record(event const& e) noexcept
+	{
+		for (uint64_t v : {static_cast<uint64_t>(e.at.count()), e.seq})
+		{
+			for (int i = 0; i < 8; ++i)
+			{
+				trace_ = (trace_ ^ ((v >> (8 * i)) & 0xff)) * 1099511628211ull;
+			}
+		}
+	}
+
+	// runs the earliest event, false if there is none due up to `until`
+	bool step(duration until)
+	{
+		if ((queue_.empty() || queue_.front().at > until))
+		{
+			return false;
+		}
+		std::pop_heap(queue_.begin(), queue_.end(), later{});
+		event e = std::move(queue_.back());
+		queue_.pop_back();
+		now_ = e.at;
+		record(e);
+		if ((e.c))
+		{
+			std::move(e.c).resume();
+		}
+		else
+		{
+			e.fn();
+		}
+		return true;
+	}
+
+  public:
+	explicit scheduler(uint64_t seed = 0) : seed_{seed}, rng_{seed}
+	{}
+
+	// contexts still suspended are force-unwound
+	~scheduler() = default;
+
+	scheduler(scheduler const&) = delete;
+	scheduler& operator=(scheduler const&) = delete;
+
+	uint64_t seed() const noexcept
+	{
+		return seed_;
+	}
+
+	// virtual time since the scheduler was created
+	duration now() const noexcept
+	{
+		return now_;
+	}
+
+	// identifies the order in which events ran so far; equal for two runs
+	// of the same code with the same seed
+	uint64_t trace() const noexcept
+	{
+		return trace_;
+	}
+
+	std::size_t pending() const noexcept
+	{
+		return queue_.size();
+	}
+
+	uint64_t random() noexcept
+	{
+		return rng_();
+	}
+
+	// uniform in [0, 1)
+	double random_real() noexcept
+	{
+		return static_cast<double>(rng_() >> 11) * 0x1.0p-53;
+	}
+
+	// probability of io() failing with std::errc::io_error
+	void set_fault_rate(double p) noexcept
+	{
+		fault_rate_ = p;
+	}
+
+	void schedule(std::function<void()> fn, duration delay)
+	{
+		push(delay, std::move(fn), continuation{});
+	}
+
+	// drop-in for the samples' uv-based set_timeout()
+	void set_timeout(std::function<void()> fn, int ms)
+	{
+		schedule(std::move(fn), std::chrono::milliseconds{ms});
+	}
+
+	// for continuation::resume_on()
+	void post(std::function<void()> fn)
+	{
+		schedule(std::move(fn), duration{0});
+	}
+
+	// fn: void(continuation&); starts at the current virtual time, runs
+	// until it suspends through sleep()/io() or finishes. `site` ends up in
+	// the stack overflow report of the context
+	template <typename StackAlloc, typename Fn>
+	void spawn(std::allocator_arg_t, StackAlloc&& salloc, Fn&& fn, source_site site = source_site::current())
+	{
+		schedule(
+			[this, salloc = std::forward<StackAlloc>(salloc),
+			 fn = std::make_shared<typename std::decay<Fn>::type>(std::forward<Fn>(fn)), site]() mutable
+			{
+				callcc(
+					std::allocator_arg, std::move(salloc),
+					[fn](continuation&& c)
+					{
+						(*fn)(c);
+						return std::move(c);
+					},
+					site);
+			},
+			duration{0});
+	}
+
+	template <typename Fn>
+	void spawn(Fn&& fn, source_site site = source_site::current())
+	{
+		spawn(std::allocator_arg, protected_fixedsize_stack(4 * 1024 * 1024), std::forward<Fn>(fn), site);
+	}
+
+	// suspends the calling context (`c`: the continuation it was resumed
+	// with) for `d` of virtual time
+	void sleep(continuation& c, duration d)
+	{
+		park(c, [this, d](continuation&& self) { push(d, {}, std::move(self)); });
+	}
+
+	// a simulated I/O operation: suspends for a latency drawn from `l`, then
+	// throws std::errc::io_error with the configured fault rate
+	void io(continuation& c, latency const& l)
+	{
+		duration d = l(*this);
+		bool fail = random_real() < fault_rate_;
+		sleep(c, d);
+		if ((fail))
+		{
+			throw std::system_error(std::make_error_code(std::errc::io_error));
+		}
+	}
+
+	// runs events until none is left, returns how many ran
+	std::size_t run()
+	{
+		std::size_t n = 0;
+		while (step(duration::max()))
+		{
+			++n;
+		}
+		return n;
+	}
+
+	// runs the events due within `d`, then advances the clock by `d`
+	std::size_t run_for(duration d)
+	{
+		duration until = now_ + d;
+		std::size_t n = 0;
+		while (step(until))
+		{
+			++n;
+		}
+		now_ = until;
+		return n;
+	}
+};
+
+inline latency fixed(duration d)
+{
+	return [d](scheduler&) { return d; };
+}
+
+inline latency uniform(duration lo, duration hi)
+{
+	return [lo, hi](scheduler& s)
+	{ return lo + duration{static_cast<duration::rep>(s.random_real() * static_cast<double>((hi - lo).count()))}; };
+}
+
+inline latency exponential(duration mean)
+{
+	return [mean](scheduler& s)
+	{ return duration{static_cast<duration::rep>(-std::log1p(-s.random_real()) * static_cast<double>(mean.count()))}; };
+}
+
+// heavy tail: at least `min`, P(X > x) = (min / x)^alpha
+inline latency pareto(duration min, double alpha)
+{
+	return [min, alpha](scheduler& s)
+	{
+		double u = 1.0 - s.random_real();
+		double v = static_cast<double>(min.count()) / std::pow(u, 1.0 / alpha);
+		return duration{static_cast<duration::rep>(
+			std::min(v, static_cast<double>(std::numeric_limits<duration::rep>::max() / 2)))};
+	};
+}
+
+} // namespace sim
+} // namespace ctx
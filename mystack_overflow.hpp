@@ -0,0 +1,271 @@
+#pragma once
+
+extern "C"
+{
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <system_error>
+
+namespace ctx
+{
+
+// where a continuation was created, filled in at the call site of callcc()
+struct source_site
+{
+	char const* file{nullptr};
+	int line{0};
+
+	static constexpr source_site current(char const* file = __builtin_FILE(), int line = __builtin_LINE()) noexcept
+	{
+		return {file, line};
+	}
+};
+
+namespace detail
+{
+
+// one slot per live context stack; only touched if the overflow handler is installed
+// states: 0 free, 1 being written, 2 visible to the signal handler
+struct guard_entry
+{
+	std::atomic<int> state{0};
+	uintptr_t guard{0};
+	std::size_t guard_size{0};
+	std::size_t stack_size{0};
+	void const* record{nullptr};
+	source_site site{};
+};
+
+// sized by install_stack_overflow_handler(), published once it is mapped
+inline std::atomic<guard_entry*> guard_registry{nullptr};
+inline std::size_t guard_registry_size{0};
+// where the next registration starts looking for a free slot
+inline std::atomic<std::size_t> guard_hint{0};
+// stacks created while the registry was full
+inline std::atomic<std::size_t> guard_untracked{0};
+inline std::atomic<bool> overflow_handler_installed{false};
+inline struct sigaction previous_segv_action;
+
+inline void write_str(char const* s) noexcept;
+inline void write_num(uintptr_t v, unsigned base) noexcept;
+
+// the handler runs on this; mapped per thread, dropped when the thread exits
+struct alt_stack
+{
+	static constexpr std::size_t size = 64 * 1024;
+	void* sp{nullptr};
+
+	~alt_stack()
+	{
+		if ((nullptr != sp))
+		{
+			stack_t ss{};
+			ss.ss_flags = SS_DISABLE;
+			::sigaltstack(&ss, nullptr);
+			::munmap(sp, size);
+		}
+	}
+};
+
+// installs the alternate signal stack for the calling thread, once; errno on failure
+inline int ensure_alt_stack() noexcept
+{
+	thread_local static alt_stack as;
+	if ((nullptr != as.sp))
+	{
+		return 0;
+	}
+	void* sp = ::mmap(nullptr, alt_stack::size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((MAP_FAILED == sp))
+	{
+		return errno;
+	}
+	stack_t ss{};
+	ss.ss_sp = sp;
+	ss.ss_size = alt_stack::size;
+	if ((0 != ::sigaltstack(&ss, nullptr)))
+	{
+		int err = errno;
+		::munmap(sp, alt_stack::size);
+		return err;
+	}
+	as.sp = sp;
+	return 0;
+}
+
+// the guard page is the lowest page of the mapping (see basic_protected_fixedsize_stack::allocate())
+inline guard_entry* register_guard(stack_context const& sctx, void const* record, source_site site) noexcept
+{
+	guard_entry* registry = guard_registry.load(std::memory_order_acquire);
+	if ((nullptr == registry))
+	{
+		return nullptr;
+	}
+	std::size_t start = guard_hint.load(std::memory_order_relaxed);
+	for (std::size_t i = 0; i < guard_registry_size; ++i)
+	{
+		std::size_t index = (start + i) % guard_registry_size;
+		guard_entry& e = registry[index];
+		// plain load first, the CAS only on slots that look free
+		int expected = 0;
+		if ((0 != e.state.load(std::memory_order_relaxed) ||
+			 !e.state.compare_exchange_strong(expected, 1, std::memory_order_acquire)))
+		{
+			continue;
+		}
+		guard_hint.store(index + 1, std::memory_order_relaxed);
+		e.guard = reinterpret_cast<uintptr_t>(sctx.sp) - sctx.size;
+		e.guard_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+		e.stack_size = sctx.size;
+		e.record = record;
+		e.site = site;
+		e.state.store(2, std::memory_order_release);
+		return &e;
+	}
+	// registry full, this stack is not tracked; said once
+	if ((0 == guard_untracked.fetch_add(1, std::memory_order_relaxed)))
+	{
+		write_str("ctx: stack overflow registry full (");
+		write_num(guard_registry_size, 10);
+		write_str(" stacks), further context stacks are not tracked\n");
+	}
+	return nullptr;
+}
+
+inline void deregister_guard(guard_entry* e) noexcept
+{
+	if ((nullptr != e))
+	{
+		e->state.store(0, std::memory_order_release);
+	}
+}
+
+inline void write_str(char const* s) noexcept
+{
+	ssize_t r = ::write(STDERR_FILENO, s, std::strlen(s));
+	(void)r;
+}
+
+inline void write_num(uintptr_t v, unsigned base) noexcept
+{
+	char buf[24];
+	char* p = buf + sizeof(buf);
+	*--p = '\0';
+	do
+	{
+		*--p = "0123456789abcdef"[v % base];
+		v /= base;
+	} while (0 != v);
+	if ((16 == base))
+	{
+		*--p = 'x';
+		*--p = '0';
+	}
+	write_str(p);
+}
+
+inline void segv_handler(int sig, siginfo_t* info, void* uctx) noexcept
+{
+	uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+	guard_entry* registry = guard_registry.load(std::memory_order_acquire);
+	bool found = false;
+	for (std::size_t i = 0; nullptr != registry && i < guard_registry_size; ++i)
+	{
+		guard_entry& e = registry[i];
+		if ((2 == e.state.load(std::memory_order_acquire)) && e.guard <= addr && addr < e.guard + e.guard_size)
+		{
+			found = true;
+			write_str("ctx: stack overflow in continuation ");
+			write_num(reinterpret_cast<uintptr_t>(e.record), 16);
+			write_str(", stack size ");
+			write_num(e.stack_size, 10);
+			write_str(" bytes, created at ");
+			write_str(nullptr != e.site.file ? e.site.file : "?");
+			write_str(":");
+			write_num(static_cast<uintptr_t>(e.site.line), 10);
+			write_str("\n");
+			break;
+		}
+	}
+	if ((!found && 0 != guard_untracked.load(std::memory_order_relaxed)))
+	{
+		write_str("ctx: SIGSEGV at ");
+		write_num(addr, 16);
+		write_str(", ");
+		write_num(guard_untracked.load(std::memory_order_relaxed), 10);
+		write_str(" context stacks were not tracked (registry full), it may be an overflow of one of them\n");
+	}
+	// hand over to whoever was installed before us
+	if ((previous_segv_action.sa_flags & SA_SIGINFO))
+	{
+		previous_segv_action.sa_sigaction(sig, info, uctx);
+		return;
+	}
+	if ((SIG_IGN != previous_segv_action.sa_handler && SIG_DFL != previous_segv_action.sa_handler))
+	{
+		previous_segv_action.sa_handler(sig);
+		return;
+	}
+	// returning re-executes the faulting instruction, now with the default action
+	::signal(SIGSEGV, SIG_DFL);
+}
+
+} // namespace detail
+
+// installs a SIGSEGV handler reporting faults inside the guard page of any
+// context stack created afterwards; the handler runs on an alternate signal
+// stack, set up for every thread the first time it switches contexts (the
+// calling thread right away), so call it before starting threads that
+// resume continuations, e.g. executor workers. `capacity`: live stacks
+// tracked at most, fixed by the first call; the default covers the stacks
+// that fit under the default vm.max_map_count (two VMAs each)
+inline void install_stack_overflow_handler(std::size_t capacity = 32768)
+{
+	int err = detail::ensure_alt_stack();
+	if ((0 != err))
+	{
+		throw std::system_error(std::error_code(err, std::system_category()), "sigaltstack() failed");
+	}
+	if ((detail::overflow_handler_installed.exchange(true)))
+	{
+		return;
+	}
+	if ((nullptr == detail::guard_registry.load(std::memory_order_relaxed)))
+	{
+		// lives until exit
+		void* registry = ::mmap(nullptr, capacity * sizeof(detail::guard_entry), PROT_READ | PROT_WRITE,
+								MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if ((MAP_FAILED == registry))
+		{
+			detail::overflow_handler_installed = false;
+			throw std::system_error(std::error_code(errno, std::system_category()), "mmap() of guard registry failed");
+		}
+		detail::guard_registry_size = capacity;
+		detail::guard_registry.store(new (registry) detail::guard_entry[capacity], std::memory_order_release);
+	}
+	struct sigaction sa{};
+	sa.sa_sigaction = detail::segv_handler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	if ((0 != ::sigaction(SIGSEGV, &sa, &detail::previous_segv_action)))
+	{
+		detail::overflow_handler_installed = false;
+		throw std::system_error(std::error_code(errno, std::system_category()), "sigaction() failed");
+	}
+}
+
+// context stacks created while the registry was full, not covered by the handler
+inline std::size_t untracked_stacks() noexcept
+{
+	return detail::guard_untracked.load(std::memory_order_relaxed);
+}
+
+} // namespace ctx
@@ -0,0 +1,535 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "mycontinuation_ucontext.hpp"
+#include <uv.h>
+
+namespace ctx
+{
+
+class slice;
+
+// fixed-size chunks carved out of large slabs, one pool per loop
+//
+// chunks are handed out as refcounted slices; sub-slices share the chunk,
+// which goes back to the free list once the last of them is gone. Not
+// thread-safe, the pool and all its slices belong to the loop's thread, and
+// the pool must outlive them. Slabs are only released with the pool.
+class buffer_pool
+{
+  private:
+	friend class slice;
+
+	struct chunk
+	{
+		buffer_pool* pool;
+		chunk* next;
+		std::size_t refs;
+		char* data;
+	};
+
+	std::size_t chunk_size_;
+	std::size_t chunks_per_slab_;
+	std::vector<std::unique_ptr<char[]>> slabs_{};
+	std::vector<std::unique_ptr<chunk[]>> headers_{};
+	chunk* free_{nullptr};
+	std::size_t available_{0};
+
+	void grow()
+	{
+		slabs_.emplace_back(new char[chunk_size_ * chunks_per_slab_]);
+		headers_.emplace_back(new chunk[chunks_per_slab_]);
+		for (std::size_t i = 0; i < chunks_per_slab_; ++i)
+		{
+			headers_.back()[i] = chunk{this, free_, 0, slabs_.back().get() + i * chunk_size_};
+			free_ = &headers_.back()[i];
+		}
+		available_ += chunks_per_slab_;
+	}
+
+	void release(chunk* c) noexcept
+	{
+		c->next = free_;
+		free_ = c;
+		++available_;
+	}
+
+  public:
+	explicit buffer_pool(std::size_t chunk_size = 16 * 1024, std::size_t chunks_per_slab = 64)
+		: chunk_size_{chunk_size}, chunks_per_slab_{chunks_per_slab}
+	{}
+
+	buffer_pool(buffer_pool const&) = delete;
+	buffer_pool& operator=(buffer_pool const&) = delete;
+
+	// a whole chunk
+	slice acquire();
+
+	std::size_t chunk_size() const noexcept
+	{
+		return chunk_size_;
+	}
+
+	// chunks not referenced by any slice
+	std::size_t available() const noexcept
+	{
+		return available_;
+	}
+
+	std::size_t slabs() const noexcept
+	{
+		return slabs_.size();
+	}
+};
+
+// a view into a pool chunk; copies share the chunk, no bytes are copied
+class slice
+{
+  private:
+	friend class buffer_pool;
+
+	buffer_pool::chunk* chunk_{nullptr};
+	char* data_{nullptr};
+	std::size_t size_{0};
+
+	slice(buffer_pool::chunk* c, char* data, std::size_t size) noexcept : chunk_{c}, data_{data}, size_{size}
+	{
+		++chunk_->refs;
+	}
+
+	void drop() noexcept
+	{
+		if ((nullptr != chunk_ && 0 == --chunk_->refs))
+		{
+			chunk_->pool->release(chunk_);
+		}
+		chunk_ = nullptr;
+	}
+
+  public:
+	slice() = default;
+
+	~slice()
+	{
+		drop();
+	}
+
+	slice(slice const& other) noexcept : chunk_{other.chunk_}, data_{other.data_}, size_{other.size_}
+	{
+		if ((nullptr != chunk_))
+		{
+			++chunk_->refs;
+		}
+	}
+
+	slice(slice&& other) noexcept
+		: chunk_{std::exchange(other.chunk_, nullptr)}, data_{std::exchange(other.data_, nullptr)},
+		  size_{std::exchange(other.size_, 0)}
+	{}
+
+	slice& operator=(slice other) noexcept
+	{
+		std::swap(chunk_, other.chunk_);
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		return *this;
+	}
+
+	char* data() const noexcept
+	{
+		return data_;
+	}
+
+	std::size_t size() const noexcept
+	{
+		return size_;
+	}
+
+	bool empty() const noexcept
+	{
+		return 0 == size_;
+	}
+
+	// [off, off + len) of this slice, sharing the chunk
+	slice sub(std::size_t off, std::size_t len) const noexcept
+	{
+		return nullptr != chunk_ ? slice{chunk_, data_ + off, len} : slice{};
+	}
+
+	uv_buf_t buf() const noexcept
+	{
+		return uv_buf_init(data_, static_cast<unsigned>(size_));
+	}
+};
+
+inline slice buffer_pool::acquire()
+{
+	if ((nullptr == free_))
+	{
+		grow();
+	}
+	chunk* c = free_;
+	free_ = c->next;
+	--available_;
+	return slice{c, c->data, chunk_size_};
+}
+
+// fiber-blocking reads and writes on a connected libuv stream (tcp, pipe, tty)
+//
+// the functions are called from inside a continuation, `c` being the
+// continuation it was resumed with; they park the calling context until
+// the loop completed them and throw std::system_error on failure.
+//
+// reads land in chunks of the pool, small reads share a chunk; at most
+// `high_water` slices are buffered before reading pauses. Writes issued by
+// any number of contexts during one loop iteration are gathered and sent
+// with a single uv_try_write() (writev()) in the next idle phase, before
+// the loop polls again; whatever the socket does not take goes out with one
+// uv_write(), writes issued meanwhile form the next batch.
+//
+// takes over handle->data; one reader at a time; destroy it only once no
+// context is parked in it, before closing the handle.
+class stream
+{
+  private:
+	// lives on the stack of the parked writer
+	struct waiter
+	{
+		continuation self{};
+		int status{0};
+	};
+
+	struct batch
+	{
+		std::vector<uv_buf_t> bufs{};
+		// keeps the chunks of slices being written alive
+		std::vector<slice> held{};
+		std::vector<waiter*> waiters{};
+
+		void clear() noexcept
+		{
+			bufs.clear();
+			held.clear();
+			waiters.clear();
+		}
+	};
+
+	uv_stream_t* handle_;
+	buffer_pool& pool_;
+	std::size_t high_water_;
+	// active while a batch waits for flush(), which keeps the loop from
+	// blocking; closed with the stream, freed by its close callback
+	uv_idle_t* kick_{new uv_idle_t};
+	uv_write_t req_{};
+
+	// reading
+	std::deque<slice> inbox_{};
+	// rest of the chunk last handed to libuv
+	slice spare_{};
+	continuation reader_{};
+	bool reading_{false};
+	bool eof_{false};
+	int read_error_{0};
+
+	// writing: `queued_` collects, `inflight_` is with uv_write()
+	batch queued_{};
+	batch inflight_{};
+	bool writing_{false};
+	std::size_t writes_{0};
+	std::size_t batches_{0};
+
+	static stream* self(uv_handle_t* handle) noexcept
+	{
+		return static_cast<stream*>(handle->data);
+	}
+
+	static std::system_error error(int status, char const* what)
+	{
+		return std::system_error(std::error_code(-status, std::system_category()), what);
+	}
+
+	void start_reading()
+	{
+		if ((reading_ || eof_ || 0 != read_error_ || inbox_.size() >= high_water_))
+		{
+			return;
+		}
+		int r = uv_read_start(
+			handle_,
+			[](uv_handle_t* handle, std::size_t, uv_buf_t* buf)
+			{
+				stream* s = self(handle);
+				if ((s->spare_.empty()))
+				{
+					s->spare_ = s->pool_.acquire();
+				}
+				*buf = s->spare_.buf();
+			},
+			[](uv_stream_t* handle, ssize_t nread, uv_buf_t const*)
+			{
+				self(reinterpret_cast<uv_handle_t*>(handle))->on_read(nread);
+			});
+		if ((0 != r))
+		{
+			read_error_ = r;
+			return;
+		}
+		reading_ = true;
+	}
+
+	void stop_reading() noexcept
+	{
+		if ((reading_))
+		{
+			uv_read_stop(handle_);
+			reading_ = false;
+		}
+	}
+
+	void on_read(ssize_t nread)
+	{
+		if ((0 == nread))
+		{
+			return;
+		}
+		if ((0 > nread))
+		{
+			if ((UV_EOF == nread))
+			{
+				eof_ = true;
+			}
+			else
+			{
+				read_error_ = static_cast<int>(nread);
+			}
+			stop_reading();
+		}
+		else
+		{
+			std::size_t n = static_cast<std::size_t>(nread);
+			inbox_.push_back(spare_.sub(0, n));
+			// the next read goes behind this one unless too little is left
+			spare_ = spare_.size() - n >= pool_.chunk_size() / 4 ? spare_.sub(n, spare_.size() - n) : slice{};
+			if ((inbox_.size() >= high_water_))
+			{
+				stop_reading();
+			}
+		}
+		if ((reader_))
+		{
+			std::move(reader_).resume();
+		}
+	}
+
+	// parks the reader until on_read() delivered something
+	void wait_readable(continuation& c)
+	{
+		BOOST_ASSERT_MSG(!reader_, "stream: concurrent readers");
+		start_reading();
+		park(c, [this](continuation&& self) { reader_ = std::move(self); });
+	}
+
+	void flush()
+	{
+		uv_idle_stop(kick_);
+		if ((writing_ || queued_.bufs.empty()))
+		{
+			return;
+		}
+		std::swap(inflight_, queued_);
+		std::vector<uv_buf_t>& bufs = inflight_.bufs;
+		++batches_;
+		int r = uv_try_write(handle_, bufs.data(), static_cast<unsigned>(bufs.size()));
+		if ((UV_EAGAIN == r))
+		{
+			r = 0;
+		}
+		if ((0 > r))
+		{
+			complete(r);
+			return;
+		}
+		// skip what the socket took
+		std::size_t written = static_cast<std::size_t>(r);
+		auto it = bufs.begin();
+		for (; it != bufs.end() && written >= it->len; ++it)
+		{
+			written -= it->len;
+		}
+		bufs.erase(bufs.begin(), it);
+		if ((bufs.empty()))
+		{
+			complete(0);
+			return;
+		}
+		bufs.front().base += written;
+		bufs.front().len -= written;
+		writing_ = true;
+		r = uv_write(&req_, handle_, bufs.data(), static_cast<unsigned>(bufs.size()),
+					 [](uv_write_t* req, int status)
+					 {
+						 stream* s = static_cast<stream*>(req->data);
+						 s->writing_ = false;
+						 s->complete(status);
+						 s->flush();
+					 });
+		if ((0 != r))
+		{
+			writing_ = false;
+			complete(r);
+		}
+	}
+
+	// resumes the writers of the in-flight batch
+	void complete(int status)
+	{
+		std::vector<waiter*> waiters = std::move(inflight_.waiters);
+		inflight_.clear();
+		for (waiter* w : waiters)
+		{
+			w->status = status;
+			std::move(w->self).resume();
+		}
+	}
+
+	void enqueue(continuation& c, uv_buf_t const* bufs, std::size_t nbufs)
+	{
+		waiter w;
+		// an ongoing uv_write() flushes the batch once it completes
+		if ((queued_.bufs.empty() && !writing_))
+		{
+			uv_idle_start(kick_, [](uv_idle_t* handle) { static_cast<stream*>(handle->data)->flush(); });
+		}
+		queued_.bufs.insert(queued_.bufs.end(), bufs, bufs + nbufs);
+		queued_.waiters.push_back(&w);
+		++writes_;
+		park(c, [&w](continuation&& self) { w.self = std::move(self); });
+		if ((0 > w.status))
+		{
+			throw error(w.status, "stream write failed");
+		}
+	}
+
+  public:
+	stream(uv_stream_t* handle, buffer_pool& pool, std::size_t high_water = 16)
+		: handle_{handle}, pool_{pool}, high_water_{high_water}
+	{
+		handle_->data = this;
+		req_.data = this;
+		uv_idle_init(handle_->loop, kick_);
+		kick_->data = this;
+	}
+
+	~stream()
+	{
+		stop_reading();
+		uv_close(reinterpret_cast<uv_handle_t*>(kick_),
+				 [](uv_handle_t* handle) { delete reinterpret_cast<uv_idle_t*>(handle); });
+	}
+
+	stream(stream const&) = delete;
+	stream& operator=(stream const&) = delete;
+
+	// the next chunk of input as it arrived, no copy; empty at end of stream
+	slice read(continuation& c)
+	{
+		while (inbox_.empty())
+		{
+			if ((0 != read_error_))
+			{
+				throw error(read_error_, "stream read failed");
+			}
+			if ((eof_))
+			{
+				return {};
+			}
+			wait_readable(c);
+		}
+		slice s = std::move(inbox_.front());
+		inbox_.pop_front();
+		start_reading();
+		return s;
+	}
+
+	// scatters buffered input over `bufs`, waits only if nothing is buffered;
+	// returns the bytes copied, 0 at end of stream
+	std::size_t readv(continuation& c, uv_buf_t const* bufs, std::size_t nbufs)
+	{
+		if ((inbox_.empty()))
+		{
+			slice s = read(c);
+			if ((s.empty()))
+			{
+				return 0;
+			}
+			inbox_.push_front(std::move(s));
+		}
+		std::size_t total = 0;
+		for (std::size_t i = 0; i < nbufs; ++i)
+		{
+			std::size_t off = 0;
+			while (off < bufs[i].len && !inbox_.empty())
+			{
+				slice& s = inbox_.front();
+				std::size_t n = std::min(s.size(), bufs[i].len - off);
+				std::memcpy(bufs[i].base + off, s.data(), n);
+				off += n;
+				if ((n == s.size()))
+				{
+					inbox_.pop_front();
+				}
+				else
+				{
+					s = s.sub(n, s.size() - n);
+				}
+			}
+			total += off;
+		}
+		start_reading();
+		return total;
+	}
+
+	// gathers `bufs` into the current batch; returns once they were handed
+	// to the kernel, the memory must stay valid until then
+	void writev(continuation& c, uv_buf_t const* bufs, std::size_t nbufs)
+	{
+		if ((0 != nbufs))
+		{
+			enqueue(c, bufs, nbufs);
+		}
+	}
+
+	// writes a slice without copying, e.g. one read from another stream
+	void write(continuation& c, slice s)
+	{
+		if ((s.empty()))
+		{
+			return;
+		}
+		uv_buf_t buf = s.buf();
+		queued_.held.push_back(std::move(s));
+		enqueue(c, &buf, 1);
+	}
+
+	// write()/writev() calls so far
+	std::size_t writes() const noexcept
+	{
+		return writes_;
+	}
+
+	// batches sent so far, one uv_try_write() each
+	std::size_t batches() const noexcept
+	{
+		return batches_;
+	}
+};
+
+} // namespace ctx
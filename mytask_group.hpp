@@ -0,0 +1,361 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "mycontinuation_ucontext.hpp"
+#include <uv.h>
+
+namespace ctx
+{
+
+// structured concurrency for continuations
+//
+// spawn() starts children right away, they run until they park() or finish.
+// join() parks the parent context until every child finished and rethrows
+// the first exception thrown by any of them. The first failure (or cancel(),
+// or an expired deadline) cancels the other children: parked ones are
+// destroyed, which force-unwinds their stacks, running ones get
+// std::errc::operation_canceled from their next park().
+//
+// the waker handed out by park() may be invoked from any thread; children
+// and the parent should only suspend through park()/join() or run to
+// completion (see ctx::park()).
+class task_group
+{
+  private:
+	struct state;
+
+	struct slot
+	{
+		// non-empty while the child is parked
+		continuation self{};
+	};
+
+	struct deadline
+	{
+		uv_timer_t timer{};
+		std::weak_ptr<state> st{};
+	};
+
+	struct state
+	{
+		std::mutex mtx{};
+		std::vector<std::shared_ptr<slot>> slots{};
+		std::size_t active{0};
+		bool cancelled{false};
+		std::exception_ptr error{};
+		// parked in join()
+		continuation parent{};
+		deadline* timer{nullptr};
+
+		// takes the parked children out under the lock, unwinds them without it
+		void cancel(std::exception_ptr reason)
+		{
+			std::vector<continuation> parked;
+			{
+				std::lock_guard<std::mutex> lk{mtx};
+				if ((nullptr == error))
+				{
+					error = std::move(reason);
+				}
+				cancelled = true;
+				for (auto& sl : slots)
+				{
+					if ((sl->self))
+					{
+						parked.push_back(std::move(sl->self));
+					}
+				}
+			}
+			// ~continuation() force-unwinds each of them
+			parked.clear();
+		}
+
+		void resume_parent_if_done()
+		{
+			continuation p;
+			{
+				std::lock_guard<std::mutex> lk{mtx};
+				if ((0 != active || !parent))
+				{
+					return;
+				}
+				p = std::move(parent);
+			}
+			std::move(p).resume();
+		}
+
+		void finished(slot* sl) noexcept
+		{
+			std::lock_guard<std::mutex> lk{mtx};
+			--active;
+			for (auto it = slots.begin(); it != slots.end(); ++it)
+			{
+				if ((it->get() == sl))
+				{
+					slots.erase(it);
+					break;
+				}
+			}
+		}
+	};
+
+	std::shared_ptr<state> st_{std::make_shared<state>()};
+
+	static std::exception_ptr cancelled_error()
+	{
+		return std::make_exception_ptr(std::system_error(std::make_error_code(std::errc::operation_canceled)));
+	}
+
+	static void close_deadline(deadline* d)
+	{
+		uv_timer_stop(&d->timer);
+		uv_close(reinterpret_cast<uv_handle_t*>(&d->timer),
+				 [](uv_handle_t* handle) { delete static_cast<deadline*>(handle->data); });
+	}
+
+	void drop_deadline()
+	{
+		deadline* d;
+		{
+			std::lock_guard<std::mutex> lk{st_->mtx};
+			d = std::exchange(st_->timer, nullptr);
+		}
+		if ((nullptr != d))
+		{
+			close_deadline(d);
+		}
+	}
+
+  public:
+	// resumes a parked child; copyable, so it fits std::function<void()>
+	class waker
+	{
+	  private:
+		std::shared_ptr<state> st_;
+		std::shared_ptr<slot> sl_;
+
+	  public:
+		waker(std::shared_ptr<state> st, std::shared_ptr<slot> sl) noexcept : st_{std::move(st)}, sl_{std::move(sl)}
+		{}
+
+		void operator()() const
+		{
+			continuation self;
+			{
+				std::lock_guard<std::mutex> lk{st_->mtx};
+				self = std::move(sl_->self);
+			}
+			// cancelled or woken already
+			if ((!self))
+			{
+				return;
+			}
+			std::move(self).resume();
+			st_->resume_parent_if_done();
+		}
+	};
+
+	// handed to every spawned function
+	class child
+	{
+	  private:
+		friend class task_group;
+
+		continuation& c_;
+		std::shared_ptr<state> st_;
+		std::shared_ptr<slot> sl_;
+
+		child(continuation& c, std::shared_ptr<state> st, std::shared_ptr<slot> sl) noexcept
+			: c_{c}, st_{std::move(st)}, sl_{std::move(sl)}
+		{}
+
+	  public:
+		// suspends the child; `arm` receives the waker that resumes it,
+		// e.g. park([](auto wake) { set_timeout(wake, 10); }). `arm` is
+		// copied: the waker may resume the child before `arm` returned.
+		template <typename Arm>
+		void park(Arm&& arm)
+		{
+			if ((cancelled()))
+			{
+				std::rethrow_exception(cancelled_error());
+			}
+			ctx::park(c_,
+					  [st = st_, sl = sl_, arm = std::forward<Arm>(arm)](continuation&& self)
+					  {
+						  {
+							  std::lock_guard<std::mutex> lk{st->mtx};
+							  // cancel() ran after the check above, it didn't see the child parked
+							  if ((!st->cancelled))
+							  {
+								  sl->self = std::move(self);
+							  }
+						  }
+						  if ((self))
+						  {
+							  return std::move(self).resume();
+						  }
+						  arm(waker{st, sl});
+						  return continuation{};
+					  });
+			if ((cancelled()))
+			{
+				std::rethrow_exception(cancelled_error());
+			}
+		}
+
+		bool cancelled() const
+		{
+			std::lock_guard<std::mutex> lk{st_->mtx};
+			return st_->cancelled;
+		}
+	};
+
+	task_group() = default;
+
+	task_group(task_group const&) = delete;
+	task_group& operator=(task_group const&) = delete;
+
+	// children still parked are cancelled; call join() first to wait for them
+	~task_group()
+	{
+		drop_deadline();
+		st_->cancel(cancelled_error());
+	}
+
+	// fn: void(task_group::child&); runs until it parks or finishes.
+	// `site` ends up in the stack overflow report of the child
+	template <typename StackAlloc, typename Fn>
+	void spawn(std::allocator_arg_t, StackAlloc&& salloc, Fn&& fn, source_site site = source_site::current())
+	{
+		auto sl = std::make_shared<slot>();
+		{
+			std::lock_guard<std::mutex> lk{st_->mtx};
+			if ((st_->cancelled))
+			{
+				return;
+			}
+			++st_->active;
+			st_->slots.push_back(sl);
+		}
+		callcc(std::allocator_arg, std::forward<StackAlloc>(salloc),
+			   [st = st_, sl, fn = std::forward<Fn>(fn)](continuation&& c) mutable
+			   {
+				   struct finish_guard
+				   {
+					   state& st;
+					   slot* sl;
+					   ~finish_guard()
+					   {
+						   st.finished(sl);
+					   }
+				   } guard{*st, sl.get()};
+				   child ch{c, st, sl};
+				   try
+				   {
+					   fn(ch);
+				   }
+				   catch (detail::forced_unwind const&)
+				   {
+					   throw;
+				   }
+				   catch (...)
+				   {
+					   st->cancel(std::current_exception());
+				   }
+				   return std::move(c);
+			   },
+			   site);
+	}
+
+	template <typename Fn>
+	void spawn(Fn&& fn, source_site site = source_site::current())
+	{
+		spawn(std::allocator_arg, protected_fixedsize_stack(4 * 1024 * 1024), std::forward<Fn>(fn), site);
+	}
+
+	// parks the calling context (`c`: the continuation it was resumed with)
+	// until all children finished, then rethrows the first failure
+	void join(continuation& c)
+	{
+		bool wait;
+		{
+			std::lock_guard<std::mutex> lk{st_->mtx};
+			wait = 0 != st_->active;
+		}
+		if ((wait))
+		{
+			park(c,
+				 [st = st_](continuation&& self)
+				 {
+					 {
+						 std::lock_guard<std::mutex> lk{st->mtx};
+						 if ((0 != st->active))
+						 {
+							 st->parent = std::move(self);
+							 return continuation{};
+						 }
+					 }
+					 // the last child finished in the meantime
+					 return std::move(self).resume();
+				 });
+		}
+		drop_deadline();
+		std::exception_ptr error;
+		{
+			std::lock_guard<std::mutex> lk{st_->mtx};
+			error = st_->error;
+		}
+		if ((nullptr != error))
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+	// cancels all children, join() then throws std::errc::operation_canceled
+	void cancel()
+	{
+		st_->cancel(cancelled_error());
+		st_->resume_parent_if_done();
+	}
+
+	// cancels the group with std::errc::timed_out unless it was joined within `ms`;
+	// replaces an earlier deadline
+	void cancel_after(unsigned ms, uv_loop_t* loop = uv_default_loop())
+	{
+		drop_deadline();
+		auto* d = new deadline{};
+		d->st = st_;
+		uv_timer_init(loop, &d->timer);
+		d->timer.data = d;
+		uv_timer_start(
+			&d->timer,
+			[](uv_timer_t* handle)
+			{
+				auto* d = static_cast<deadline*>(handle->data);
+				if (auto st = d->st.lock())
+				{
+					{
+						std::lock_guard<std::mutex> lk{st->mtx};
+						st->timer = nullptr;
+					}
+					st->cancel(std::make_exception_ptr(std::system_error(std::make_error_code(std::errc::timed_out))));
+					st->resume_parent_if_done();
+				}
+				uv_close(reinterpret_cast<uv_handle_t*>(handle),
+						 [](uv_handle_t* handle) { delete static_cast<deadline*>(handle->data); });
+			},
+			ms, 0);
+		std::lock_guard<std::mutex> lk{st_->mtx};
+		st_->timer = d;
+	}
+};
+
+} // namespace ctx
@@ -0,0 +1,605 @@
+#pragma once
+
+extern "C"
+{
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "mycontinuation_ucontext.hpp"
+#include <uv.h>
+
+namespace ctx
+{
+
+// a file registered with uring::register_files(), addressed by its index
+struct fixed_file
+{
+	unsigned index;
+};
+
+// io_uring engine driven by a libuv loop
+//
+// the I/O functions are called from inside a continuation, `c` being the
+// continuation it was resumed with; they queue the request, park the calling
+// context and return the result (>= 0) or -errno once it completed. Requests
+// are submitted in one io_uring_enter() per loop iteration (uv_prepare_t) and
+// all completions are reaped in one pass when the ring fd turns readable.
+//
+// requests the kernel can't do are served through libuv instead: uv_poll_t
+// readiness, then the plain syscall. That is every request if
+// io_uring_setup() is unavailable (older kernel, seccomp), and on kernels
+// before 5.6, which lack IORING_REGISTER_PROBE, everything but
+// read_fixed()/write_fixed(); ACCEPT is 5.5+, READ/WRITE 5.6+.
+class uring
+{
+  private:
+	enum class op_kind
+	{
+		read,
+		write,
+		accept,
+		timeout
+	};
+
+	struct target
+	{
+		int fd;
+		bool fixed;
+	};
+
+	// lives on the stack of the parked context
+	struct op
+	{
+		continuation self{};
+		int res{0};
+		// fallback path only
+		op_kind kind{op_kind::read};
+		int fd{-1};
+		void* buf{nullptr};
+		unsigned len{0};
+		off_t off{-1};
+		sockaddr* addr{nullptr};
+		socklen_t* addrlen{nullptr};
+		union
+		{
+			uv_poll_t poll;
+			uv_timer_t timer;
+		};
+	};
+
+	uv_loop_t* loop_;
+	int fd_{-1};
+	// submission queue
+	void* sq_ptr_{nullptr};
+	std::size_t sq_size_{0};
+	unsigned* sq_head_{nullptr};
+	unsigned* sq_tail_{nullptr};
+	unsigned* sq_mask_{nullptr};
+	unsigned* sq_array_{nullptr};
+	unsigned sq_entries_{0};
+	io_uring_sqe* sqes_{nullptr};
+	std::size_t sqes_size_{0};
+	unsigned to_submit_{0};
+	// completion queue
+	void* cq_ptr_{nullptr};
+	std::size_t cq_size_{0};
+	unsigned* cq_head_{nullptr};
+	unsigned* cq_tail_{nullptr};
+	unsigned* cq_mask_{nullptr};
+	io_uring_cqe* cqes_{nullptr};
+	std::size_t pending_{0};
+	// requests the kernel refused, resumed by flush()
+	std::vector<op*> failed_{};
+	// opcodes the kernel implements
+	bool supported_[IORING_OP_LAST]{};
+	uv_prepare_t* prepare_{nullptr};
+	uv_poll_t* ring_poll_{nullptr};
+	// registered resources, kept for the fallback path
+	std::vector<iovec> buffers_{};
+	std::vector<int> files_{};
+
+	static int sys_setup(unsigned entries, io_uring_params* p) noexcept
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+	}
+
+	static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+	}
+
+	static int sys_register(int fd, unsigned opcode, void const* arg, unsigned nr) noexcept
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr));
+	}
+
+	template <typename T>
+	static T* at(void* base, unsigned offset) noexcept
+	{
+		return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+	}
+
+	bool setup(unsigned entries)
+	{
+		io_uring_params p{};
+		fd_ = sys_setup(entries, &p);
+		if ((0 > fd_))
+		{
+			return false;
+		}
+		sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if ((p.features & IORING_FEAT_SINGLE_MMAP))
+		{
+			sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+		}
+		sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+		if ((MAP_FAILED == sq_ptr_))
+		{
+			throw std::system_error(std::error_code(errno, std::system_category()), "mmap() of io_uring SQ failed");
+		}
+		cq_ptr_ = sq_ptr_;
+		if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+		{
+			cq_ptr_ =
+				::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+			if ((MAP_FAILED == cq_ptr_))
+			{
+				throw std::system_error(std::error_code(errno, std::system_category()), "mmap() of io_uring CQ failed");
+			}
+		}
+		sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+		if ((MAP_FAILED == sqes))
+		{
+			throw std::system_error(std::error_code(errno, std::system_category()), "mmap() of io_uring SQEs failed");
+		}
+		sqes_ = static_cast<io_uring_sqe*>(sqes);
+		sq_head_ = at<unsigned>(sq_ptr_, p.sq_off.head);
+		sq_tail_ = at<unsigned>(sq_ptr_, p.sq_off.tail);
+		sq_mask_ = at<unsigned>(sq_ptr_, p.sq_off.ring_mask);
+		sq_array_ = at<unsigned>(sq_ptr_, p.sq_off.array);
+		sq_entries_ = p.sq_entries;
+		cq_head_ = at<unsigned>(cq_ptr_, p.cq_off.head);
+		cq_tail_ = at<unsigned>(cq_ptr_, p.cq_off.tail);
+		cq_mask_ = at<unsigned>(cq_ptr_, p.cq_off.ring_mask);
+		cqes_ = at<io_uring_cqe>(cq_ptr_, p.cq_off.cqes);
+		return true;
+	}
+
+	void probe()
+	{
+		// io_uring_probe is followed by 256 io_uring_probe_op
+		std::vector<io_uring_probe_op> buf(2 + 256);
+		auto* p = reinterpret_cast<io_uring_probe*>(buf.data());
+		if ((0 > sys_register(fd_, IORING_REGISTER_PROBE, p, 256)))
+		{
+			// before 5.6; of the opcodes used here only the fixed ones are older
+			supported_[IORING_OP_READ_FIXED] = supported_[IORING_OP_WRITE_FIXED] = true;
+			return;
+		}
+		for (unsigned i = 0; i < p->ops_len; ++i)
+		{
+			if ((p->ops[i].op < IORING_OP_LAST))
+			{
+				supported_[p->ops[i].op] = 0 != (p->ops[i].flags & IO_URING_OP_SUPPORTED);
+			}
+		}
+	}
+
+	io_uring_sqe* get_sqe()
+	{
+		unsigned tail = *sq_tail_ + to_submit_;
+		if ((tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_))
+		{
+			// ring full, submit what we have right away
+			submit();
+			tail = *sq_tail_;
+		}
+		unsigned index = tail & *sq_mask_;
+		io_uring_sqe* sqe = &sqes_[index];
+		*sqe = io_uring_sqe{};
+		sq_array_[index] = index;
+		++to_submit_;
+		return sqe;
+	}
+
+	io_uring_sqe* prep(op& o, unsigned opcode, target t, void const* addr, unsigned len, uint64_t off)
+	{
+		io_uring_sqe* sqe = get_sqe();
+		sqe->opcode = static_cast<uint8_t>(opcode);
+		sqe->fd = t.fd;
+		sqe->flags = t.fixed ? IOSQE_FIXED_FILE : 0;
+		sqe->addr = reinterpret_cast<uintptr_t>(addr);
+		sqe->len = len;
+		sqe->off = off;
+		sqe->user_data = reinterpret_cast<uintptr_t>(&o);
+		return sqe;
+	}
+
+	// parks the calling context in `o` until reap() or the fallback resumes it
+	static void park(continuation& c, op& o)
+	{
+		ctx::park(c, [&o](continuation&& self) { o.self = std::move(self); });
+	}
+
+	int wait(continuation& c, op& o)
+	{
+		++pending_;
+		uv_ref(reinterpret_cast<uv_handle_t*>(ring_poll_));
+		park(c, o);
+		return o.res;
+	}
+
+	// leaves the SQ empty: what io_uring_enter() does not take is failed
+	// with its -errno (-EAGAIN if it took nothing without an error) and
+	// queued for flush()
+	void submit()
+	{
+		if ((0 == to_submit_))
+		{
+			return;
+		}
+		unsigned tail = *sq_tail_ + std::exchange(to_submit_, 0);
+		__atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+		for (;;)
+		{
+			unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+			if ((head == tail))
+			{
+				return;
+			}
+			int r = sys_enter(fd_, tail - head, 0, 0);
+			// a short count goes on with the rest
+			if ((0 < r || (0 > r && EINTR == errno)))
+			{
+				continue;
+			}
+			int res = 0 > r ? -errno : -EAGAIN;
+			for (unsigned i = head; i != tail; ++i)
+			{
+				io_uring_sqe& sqe = sqes_[sq_array_[i & *sq_mask_]];
+				op* o = reinterpret_cast<op*>(static_cast<uintptr_t>(sqe.user_data));
+				o->res = res;
+				failed_.push_back(o);
+			}
+			// without SQPOLL the kernel reads the tail only inside io_uring_enter()
+			__atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+			pending_ -= tail - head;
+			if ((0 == pending_))
+			{
+				uv_unref(reinterpret_cast<uv_handle_t*>(ring_poll_));
+			}
+			return;
+		}
+	}
+
+	// runs right before the loop blocks; submit() may run inside a context
+	// (get_sqe() on a full ring), so the refused requests are resumed here
+	void flush()
+	{
+		submit();
+		while (!failed_.empty())
+		{
+			std::vector<op*> failed = std::move(failed_);
+			failed_.clear();
+			for (op* o : failed)
+			{
+				o->self.resume();
+			}
+			// the resumed contexts may have queued new requests
+			submit();
+		}
+	}
+
+	void reap()
+	{
+		// collect first, resumed contexts may queue new requests
+		std::vector<op*> ready;
+		unsigned head = *cq_head_;
+		unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head)
+		{
+			io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+			op* o = reinterpret_cast<op*>(static_cast<uintptr_t>(cqe.user_data));
+			o->res = cqe.res;
+			ready.push_back(o);
+		}
+		__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+		pending_ -= ready.size();
+		if ((0 == pending_))
+		{
+			uv_unref(reinterpret_cast<uv_handle_t*>(ring_poll_));
+		}
+		for (op* o : ready)
+		{
+			o->self.resume();
+		}
+	}
+
+	// ---- libuv fallback ----
+
+	static int perform(op& o) noexcept
+	{
+		ssize_t r = -1;
+		switch (o.kind)
+		{
+		case op_kind::read:
+			r = 0 > o.off ? ::read(o.fd, o.buf, o.len) : ::pread(o.fd, o.buf, o.len, o.off);
+			break;
+		case op_kind::write:
+			r = 0 > o.off ? ::write(o.fd, o.buf, o.len) : ::pwrite(o.fd, o.buf, o.len, o.off);
+			break;
+		case op_kind::accept:
+			r = ::accept4(o.fd, o.addr, o.addrlen, SOCK_CLOEXEC);
+			break;
+		case op_kind::timeout:
+			break;
+		}
+		return 0 > r ? -errno : static_cast<int>(r);
+	}
+
+	static void fallback_done(uv_handle_t* handle)
+	{
+		op* o = static_cast<op*>(handle->data);
+		o->self.resume();
+	}
+
+	int fallback(continuation& c, op& o)
+	{
+		if ((op_kind::timeout == o.kind))
+		{
+			uv_timer_init(loop_, &o.timer);
+			o.timer.data = &o;
+			uv_timer_start(
+				&o.timer,
+				[](uv_timer_t* handle)
+				{
+					uv_close(reinterpret_cast<uv_handle_t*>(handle), fallback_done);
+				},
+				o.len, 0);
+			park(c, o);
+			return 0;
+		}
+		// regular files can't be polled, they are always ready anyway
+		if ((0 != uv_poll_init(loop_, &o.poll, o.fd)))
+		{
+			return perform(o);
+		}
+		o.poll.data = &o;
+		uv_poll_start(
+			&o.poll, op_kind::write == o.kind ? UV_WRITABLE : UV_READABLE,
+			[](uv_poll_t* handle, int status, int events)
+			{
+				op* o = static_cast<op*>(handle->data);
+				o->res = 0 > status ? status : perform(*o);
+				if ((-EAGAIN == o->res || -EWOULDBLOCK == o->res))
+				{
+					return;
+				}
+				uv_close(reinterpret_cast<uv_handle_t*>(handle), fallback_done);
+			});
+		park(c, o);
+		return o.res;
+	}
+
+	int fallback(continuation& c, op_kind kind, target t, void* buf, unsigned len, off_t off)
+	{
+		op o;
+		o.kind = kind;
+		o.fd = t.fixed ? files_.at(t.fd) : t.fd;
+		o.buf = buf;
+		o.len = len;
+		o.off = off;
+		return fallback(c, o);
+	}
+
+	int rw(continuation& c, op_kind kind, target t, void* buf, unsigned len, off_t off)
+	{
+		unsigned opcode = op_kind::read == kind ? IORING_OP_READ : IORING_OP_WRITE;
+		if ((!native(opcode)))
+		{
+			return fallback(c, kind, t, buf, len, off);
+		}
+		op o;
+		prep(o, opcode, t, buf, len, static_cast<uint64_t>(off));
+		return wait(c, o);
+	}
+
+	int rw_fixed(continuation& c, op_kind kind, target t, void* buf, unsigned len, unsigned buf_index, off_t off)
+	{
+		unsigned opcode = op_kind::read == kind ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+		if ((!native(opcode)))
+		{
+			return fallback(c, kind, t, buf, len, off);
+		}
+		op o;
+		io_uring_sqe* sqe = prep(o, opcode, t, buf, len, static_cast<uint64_t>(off));
+		sqe->buf_index = static_cast<uint16_t>(buf_index);
+		return wait(c, o);
+	}
+
+	int do_accept(continuation& c, target t, sockaddr* addr, socklen_t* addrlen)
+	{
+		if ((!native(IORING_OP_ACCEPT)))
+		{
+			op o;
+			o.kind = op_kind::accept;
+			o.fd = t.fixed ? files_.at(t.fd) : t.fd;
+			o.addr = addr;
+			o.addrlen = addrlen;
+			return fallback(c, o);
+		}
+		op o;
+		io_uring_sqe* sqe = prep(o, IORING_OP_ACCEPT, t, addr, 0, reinterpret_cast<uintptr_t>(addrlen));
+		sqe->accept_flags = SOCK_CLOEXEC;
+		return wait(c, o);
+	}
+
+  public:
+	explicit uring(unsigned entries = 256, uv_loop_t* loop = uv_default_loop()) : loop_{loop}
+	{
+		if ((!setup(entries)))
+		{
+			return;
+		}
+		probe();
+		// submit once per loop iteration, right before the loop blocks
+		prepare_ = new uv_prepare_t;
+		uv_prepare_init(loop_, prepare_);
+		prepare_->data = this;
+		uv_prepare_start(prepare_, [](uv_prepare_t* handle) { static_cast<uring*>(handle->data)->flush(); });
+		uv_unref(reinterpret_cast<uv_handle_t*>(prepare_));
+		// the ring fd turns readable when the CQ is non-empty
+		ring_poll_ = new uv_poll_t;
+		uv_poll_init(loop_, ring_poll_, fd_);
+		ring_poll_->data = this;
+		uv_poll_start(ring_poll_, UV_READABLE,
+					  [](uv_poll_t* handle, int status, int events) { static_cast<uring*>(handle->data)->reap(); });
+		uv_unref(reinterpret_cast<uv_handle_t*>(ring_poll_));
+	}
+
+	// the handles are freed by the loop once their close callbacks ran
+	~uring()
+	{
+		if ((!native()))
+		{
+			return;
+		}
+		uv_close(reinterpret_cast<uv_handle_t*>(prepare_),
+				 [](uv_handle_t* handle) { delete reinterpret_cast<uv_prepare_t*>(handle); });
+		uv_close(reinterpret_cast<uv_handle_t*>(ring_poll_),
+				 [](uv_handle_t* handle) { delete reinterpret_cast<uv_poll_t*>(handle); });
+		::munmap(sqes_, sqes_size_);
+		if ((cq_ptr_ != sq_ptr_))
+		{
+			::munmap(cq_ptr_, cq_size_);
+		}
+		::munmap(sq_ptr_, sq_size_);
+		::close(fd_);
+	}
+
+	uring(uring const&) = delete;
+	uring& operator=(uring const&) = delete;
+
+	// false if all requests are served by the libuv fallback
+	bool native() const noexcept
+	{
+		return 0 <= fd_;
+	}
+
+	// false if requests with IORING_OP_`opcode` are served by the libuv fallback
+	bool native(unsigned opcode) const noexcept
+	{
+		return native() && opcode < IORING_OP_LAST && supported_[opcode];
+	}
+
+	// buffers for read_fixed()/write_fixed(), pinned by the kernel once
+	void register_buffers(iovec const* iov, unsigned nr)
+	{
+		if ((native() && 0 > sys_register(fd_, IORING_REGISTER_BUFFERS, iov, nr)))
+		{
+			throw std::system_error(std::error_code(errno, std::system_category()), "IORING_REGISTER_BUFFERS failed");
+		}
+		buffers_.assign(iov, iov + nr);
+	}
+
+	// files addressed by fixed_file{index} afterwards, saving the fd lookup per request
+	void register_files(int const* fds, unsigned nr)
+	{
+		if ((native() && 0 > sys_register(fd_, IORING_REGISTER_FILES, fds, nr)))
+		{
+			throw std::system_error(std::error_code(errno, std::system_category()), "IORING_REGISTER_FILES failed");
+		}
+		files_.assign(fds, fds + nr);
+	}
+
+	// off < 0: use (and advance) the file position
+	int read(continuation& c, int fd, void* buf, unsigned len, off_t off = -1)
+	{
+		return rw(c, op_kind::read, target{fd, false}, buf, len, off);
+	}
+
+	int read(continuation& c, fixed_file f, void* buf, unsigned len, off_t off = -1)
+	{
+		return rw(c, op_kind::read, target{static_cast<int>(f.index), true}, buf, len, off);
+	}
+
+	int write(continuation& c, int fd, void const* buf, unsigned len, off_t off = -1)
+	{
+		return rw(c, op_kind::write, target{fd, false}, const_cast<void*>(buf), len, off);
+	}
+
+	int write(continuation& c, fixed_file f, void const* buf, unsigned len, off_t off = -1)
+	{
+		return rw(c, op_kind::write, target{static_cast<int>(f.index), true}, const_cast<void*>(buf), len, off);
+	}
+
+	// `buf` must lie inside registered buffer `buf_index`
+	template <typename Fd>
+	int read_fixed(continuation& c, Fd fd, void* buf, unsigned len, unsigned buf_index, off_t off = -1)
+	{
+		return rw_fixed(c, op_kind::read, to_target(fd), buf, len, buf_index, off);
+	}
+
+	template <typename Fd>
+	int write_fixed(continuation& c, Fd fd, void const* buf, unsigned len, unsigned buf_index, off_t off = -1)
+	{
+		return rw_fixed(c, op_kind::write, to_target(fd), const_cast<void*>(buf), len, buf_index, off);
+	}
+
+	int accept(continuation& c, int fd, sockaddr* addr = nullptr, socklen_t* addrlen = nullptr)
+	{
+		return do_accept(c, target{fd, false}, addr, addrlen);
+	}
+
+	int accept(continuation& c, fixed_file f, sockaddr* addr = nullptr, socklen_t* addrlen = nullptr)
+	{
+		return do_accept(c, target{static_cast<int>(f.index), true}, addr, addrlen);
+	}
+
+	// returns 0 once `ms` milliseconds passed
+	int timeout(continuation& c, unsigned ms)
+	{
+		if ((!native(IORING_OP_TIMEOUT)))
+		{
+			op o;
+			o.kind = op_kind::timeout;
+			o.len = ms;
+			return fallback(c, o);
+		}
+		__kernel_timespec ts{};
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = static_cast<long long>(ms % 1000) * 1000000;
+		op o;
+		prep(o, IORING_OP_TIMEOUT, target{-1, false}, &ts, 1, 0);
+		int res = wait(c, o);
+		return -ETIME == res ? 0 : res;
+	}
+
+  private:
+	static target to_target(int fd) noexcept
+	{
+		return {fd, false};
+	}
+
+	static target to_target(fixed_file f) noexcept
+	{
+		return {static_cast<int>(f.index), true};
+	}
+};
+
+} // namespace ctx
@@ -0,0 +1,224 @@
+// ramps the number of live continuations per stack allocator until something gives
+// usage: stress [max contexts, default 10000000] [stack KB, default 16] > stress.csv
+// CSV on stdout, progress on stderr
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include "mycontinuation_ucontext.hpp"
+#include <unistd.h>
+
+#define F__(x) std::forward<decltype(x)>(x)
+#define M__(x) std::move(x)
+
+using namespace std;
+using stress_clock = chrono::steady_clock;
+
+static long ns_since(stress_clock::time_point t0)
+{
+	return chrono::duration_cast<chrono::nanoseconds>(stress_clock::now() - t0).count();
+}
+
+// plain heap stacks without guard page, for comparison: no VMA per context
+struct malloc_stack
+{
+	size_t size;
+
+	stack_context allocate()
+	{
+		void* vp = malloc(size);
+		if (nullptr == vp)
+			throw bad_alloc();
+		stack_context sctx;
+		sctx.size = size;
+		sctx.sp = static_cast<char*>(vp) + size;
+		return sctx;
+	}
+
+	void deallocate(stack_context& sctx) noexcept
+	{
+		free(static_cast<char*>(sctx.sp) - sctx.size);
+	}
+};
+
+static long read_long(char const* path)
+{
+	long v = 0;
+	ifstream(path) >> v;
+	return v;
+}
+
+static long rss_kb()
+{
+	long size = 0, resident = 0;
+	ifstream("/proc/self/statm") >> size >> resident;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long vma_count()
+{
+	ifstream maps("/proc/self/maps");
+	return count(istreambuf_iterator<char>(maps), istreambuf_iterator<char>(), '\n');
+}
+
+static long mem_available_kb()
+{
+	ifstream meminfo("/proc/meminfo");
+	string key;
+	long v = 0;
+	while (meminfo >> key >> v)
+	{
+		if ("MemAvailable:" == key)
+			return v;
+		meminfo.ignore(64, '\n');
+	}
+	return 0;
+}
+
+// switches back right away; resumed with data it returns, otherwise it switches back again
+static ctx::continuation idle_until_data(ctx::continuation&& c)
+{
+	for (;;)
+	{
+		c = c.resume();
+		if (c.data_available())
+			break;
+	}
+	return M__(c);
+}
+
+struct step
+{
+	long contexts = 0;
+	long created = 0;
+	string status = "ok";
+	double create_per_s = 0;
+	long rss_kb = 0;
+	long vmas = 0;
+	long lat[4] = {};
+	double destroy_per_s = 0;
+	double unwind_ms = 0;
+	double unwind_per_s = 0;
+	long rss_after_kb = 0;
+};
+
+template <class StackAlloc>
+step run_step(StackAlloc salloc, long n)
+{
+	step s;
+	s.contexts = n;
+	long rss0 = rss_kb();
+	vector<ctx::continuation> cs;
+	cs.reserve(n);
+
+	auto t0 = stress_clock::now();
+	try
+	{
+		for (long i = 0; i < n; ++i)
+			cs.push_back(ctx::callcc(allocator_arg, salloc, idle_until_data));
+	}
+	catch (bad_alloc const&)
+	{
+		s.status = "alloc_failed";
+	}
+	catch (system_error const& e)
+	{
+		s.status = "error_" + to_string(e.code().value());
+	}
+	long created_ns = ns_since(t0);
+	s.created = cs.size();
+	s.create_per_s = s.created * 1e9 / max(1L, created_ns);
+	s.rss_kb = rss_kb() - rss0;
+	s.vmas = vma_count();
+
+	// round trips to contexts picked at random, the working set grows with n
+	if (!cs.empty())
+	{
+		size_t samples = min<size_t>(cs.size(), 200000);
+		vector<long> lat;
+		lat.reserve(samples);
+		unsigned long x = 88172645463325252ul;
+		for (size_t i = 0; i < samples; ++i)
+		{
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			auto& c = cs[x % cs.size()];
+			auto t1 = stress_clock::now();
+			c = c.resume();
+			lat.push_back(ns_since(t1));
+		}
+		sort(lat.begin(), lat.end());
+		double pct[4] = {0.5, 0.9, 0.99, 0.999};
+		for (int i = 0; i < 4; ++i)
+			s.lat[i] = lat[size_t(pct[i] * (lat.size() - 1))];
+	}
+
+	// first half returns normally, the rest is force-unwound by ~continuation()
+	size_t half = cs.size() / 2;
+	t0 = stress_clock::now();
+	for (size_t i = 0; i < half; ++i)
+		M__(cs[i]).resume(1);
+	s.destroy_per_s = half * 1e9 / max(1L, ns_since(t0));
+
+	t0 = stress_clock::now();
+	for (size_t i = half; i < cs.size(); ++i)
+		cs[i] = {};
+	long unwind_ns = ns_since(t0);
+	s.unwind_ms = unwind_ns / 1e6;
+	s.unwind_per_s = (cs.size() - half) * 1e9 / max(1L, unwind_ns);
+	cs.clear();
+	cs.shrink_to_fit();
+	s.rss_after_kb = rss_kb() - rss0;
+	return s;
+}
+
+template <class StackAlloc>
+void ramp(char const* name, StackAlloc salloc, long max_contexts, long budget_kb)
+{
+	double kb_per_ctx = 0;
+	for (long n = 1000; n <= max_contexts; n *= 10)
+	{
+		step s;
+		s.contexts = n;
+		if (kb_per_ctx * n > budget_kb)
+		{
+			// would not fit into memory, measured per context on the previous step
+			s.status = "skipped_rss";
+		}
+		else
+		{
+			cerr << name << ": " << n << " contexts" << endl;
+			s = run_step(salloc, n);
+			if (0 < s.created)
+				kb_per_ctx = double(s.rss_kb) / s.created;
+		}
+		cout << name << ',' << s.contexts << ',' << s.created << ',' << s.status << ',' << long(s.create_per_s) << ','
+			 << s.rss_kb << ',' << (0 < s.created ? s.rss_kb * 1024 / s.created : 0) << ',' << s.vmas << ','
+			 << read_long("/proc/sys/vm/max_map_count") << ',' << s.lat[0] << ',' << s.lat[1] << ',' << s.lat[2]
+			 << ',' << s.lat[3] << ',' << long(s.destroy_per_s) << ',' << s.unwind_ms << ','
+			 << long(s.unwind_per_s) << ',' << s.rss_after_kb << endl;
+		if ("ok" != s.status)
+			break;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	long max_contexts = argc > 1 ? max(1000L, atol(argv[1])) : 10000000;
+	size_t stack_size = (argc > 2 ? max(4L, atol(argv[2])) : 16) * 1024;
+	// leave a quarter of the available memory alone
+	long budget_kb = mem_available_kb() / 4 * 3;
+
+	cout << "allocator,contexts,created,status,create_per_s,rss_kb,rss_per_ctx_b,vmas,max_map_count,"
+			"switch_p50_ns,switch_p90_ns,switch_p99_ns,switch_p999_ns,destroy_per_s,unwind_ms,unwind_per_s,"
+			"rss_after_kb"
+		 << endl;
+	ramp("protected_fixedsize", ctx::protected_fixedsize_stack(stack_size), max_contexts, budget_kb);
+	ramp("malloc", malloc_stack{stack_size}, max_contexts, budget_kb);
+	return 0;
+}
@@ -0,0 +1,122 @@
+// this_continuation::arena(): one per context, kept across switches, all of
+// its slabs handed back upstream when the context is destroyed
+#include <memory_resource>
+#include <vector>
+#include "../mycontinuation_ucontext.hpp"
+#include "check.hpp"
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+// counts what the arenas take from upstream
+struct counting_resource : pmr::memory_resource
+{
+	size_t live = 0, allocations = 0;
+
+	void* do_allocate(size_t bytes, size_t align) override
+	{
+		live += bytes;
+		++allocations;
+		return pmr::new_delete_resource()->allocate(bytes, align);
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t align) override
+	{
+		live -= bytes;
+		pmr::new_delete_resource()->deallocate(p, bytes, align);
+	}
+
+	bool do_is_equal(pmr::memory_resource const& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+static void isolation()
+{
+	pmr::memory_resource* main_arena = ctx::this_continuation::arena();
+	CHECK(main_arena == ctx::this_continuation::arena());
+	vector<pmr::memory_resource*> seen;
+	vector<ctx::continuation> cs;
+	for (int i = 0; i < 4; ++i)
+	{
+		cs.push_back(ctx::callcc(
+			[&seen](ctx::continuation&& c)
+			{
+				pmr::memory_resource* mine = ctx::this_continuation::arena();
+				seen.push_back(mine);
+				for (;;)
+				{
+					c = c.resume();
+					CHECK(mine == ctx::this_continuation::arena());
+				}
+				return M__(c);
+			}));
+	}
+	for (int round = 0; round < 3; ++round)
+	{
+		for (auto& c : cs)
+		{
+			c = c.resume();
+		}
+	}
+	CHECK(4 == seen.size());
+	for (size_t i = 0; i < seen.size(); ++i)
+	{
+		CHECK(main_arena != seen[i]);
+		for (size_t k = 0; k < i; ++k)
+		{
+			CHECK(seen[k] != seen[i]);
+		}
+	}
+	CHECK(main_arena == ctx::this_continuation::arena());
+}
+
+static void release()
+{
+	counting_resource upstream;
+	// an arena takes its upstream from the default resource when created
+	pmr::memory_resource* previous = pmr::set_default_resource(&upstream);
+	{
+		// finishes
+		ctx::continuation c = ctx::callcc(
+			[&upstream](ctx::continuation&& c)
+			{
+				pmr::vector<int> v{ctx::this_continuation::arena()};
+				for (int i = 0; i < 10000; ++i)
+				{
+					v.push_back(i);
+				}
+				CHECK(1 < upstream.allocations && 0 < upstream.live);
+				return M__(c);
+			});
+		CHECK(!c);
+	}
+	CHECK(0 == upstream.live);
+	size_t allocations = upstream.allocations;
+	{
+		// destroyed while parked
+		ctx::continuation c = ctx::callcc(
+			[](ctx::continuation&& c)
+			{
+				pmr::vector<int> v{ctx::this_continuation::arena()};
+				v.resize(10000);
+				for (;;)
+				{
+					c = c.resume();
+				}
+				return M__(c);
+			});
+		CHECK(allocations < upstream.allocations && 0 < upstream.live);
+	}
+	CHECK(0 == upstream.live);
+	pmr::set_default_resource(previous);
+}
+
+int main()
+{
+	isolation();
+	release();
+	return 0;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// aborts the test with file and line; works inside contexts, unlike a return
+#define CHECK(expr)                                                                                                    \
+	do                                                                                                                 \
+	{                                                                                                                  \
+		if (!(expr))                                                                                                   \
+		{                                                                                                              \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr);                              \
+			std::abort();                                                                                              \
+		}                                                                                                              \
+	} while (0)
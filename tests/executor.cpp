@@ -0,0 +1,84 @@
+// ctx::mpmc_executor: contexts yielding between workers, contexts moved onto
+// the executor with yield() and resume_on(), a queue smaller than the number
+// of contexts
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "../myexecutor.hpp"
+#include "check.hpp"
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+static void wait_for(atomic<int> const& n, int expected)
+{
+	for (int ms = 0; n != expected; ++ms)
+	{
+		CHECK(ms < 10000);
+		this_thread::sleep_for(chrono::milliseconds{1});
+	}
+}
+
+// contexts start on this thread and move over with their first yield()
+static void hops(size_t capacity, int contexts, int steps)
+{
+	atomic<int> done{0}, hops{0};
+	ctx::mpmc_executor ex{4, capacity};
+	for (int k = 0; k < contexts; ++k)
+	{
+		ctx::callcc(std::allocator_arg, ctx::protected_fixedsize_stack(64 * 1024),
+					[&](ctx::continuation&& c)
+					{
+						for (int i = 0; i < steps; ++i)
+						{
+							ex.yield(c);
+							++hops;
+						}
+						++done;
+						return M__(c);
+					});
+	}
+	wait_for(done, contexts);
+	CHECK(contexts * steps == hops);
+}
+
+static void resume_on()
+{
+	atomic<int> done{0};
+	thread::id main_id = this_thread::get_id();
+	{
+		ctx::mpmc_executor ex{2, 8};
+		for (int k = 0; k < 32; ++k)
+		{
+			ctx::callcc(
+				[&](ctx::continuation&& c)
+				{
+					ctx::park(c, [&ex](ctx::continuation&& self) { M__(self).resume_on(ex); });
+					CHECK(main_id != this_thread::get_id());
+					++done;
+					return M__(c);
+				});
+		}
+		wait_for(done, 32);
+		// workers asleep by now, post() has to wake one
+		this_thread::sleep_for(chrono::milliseconds{50});
+		ctx::callcc(
+			[&](ctx::continuation&& c)
+			{
+				ex.yield(c);
+				++done;
+				return M__(c);
+			});
+		wait_for(done, 33);
+	}
+}
+
+int main()
+{
+	hops(4096, 200, 100);
+	// yield() spins while the queue is full
+	hops(8, 64, 100);
+	resume_on();
+	return 0;
+}
@@ -0,0 +1,134 @@
+// ctx::continuation_local<T>: a value per context, destroyed with the context,
+// std::length_error once all slots are taken
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "../mycontinuation_ucontext.hpp"
+#include "check.hpp"
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+struct counted
+{
+	static inline int live = 0;
+
+	counted()
+	{
+		++live;
+	}
+
+	~counted()
+	{
+		--live;
+	}
+};
+
+static ctx::continuation_local<int> id;
+static ctx::continuation_local<counted> tracked;
+
+static void isolation()
+{
+	*id = -1;
+	vector<ctx::continuation> cs;
+	for (int i = 0; i < 4; ++i)
+	{
+		cs.push_back(ctx::callcc(
+			[i](ctx::continuation&& c)
+			{
+				// default-constructed on first access
+				CHECK(0 == *id);
+				*id = i;
+				for (;;)
+				{
+					c = c.resume();
+					CHECK(i == *id);
+				}
+				return M__(c);
+			}));
+	}
+	for (int round = 0; round < 3; ++round)
+	{
+		for (auto& c : cs)
+		{
+			c = c.resume();
+			CHECK(-1 == *id);
+		}
+	}
+}
+
+static void destruction()
+{
+	int before = counted::live;
+	{
+		// finishes
+		ctx::continuation c = ctx::callcc(
+			[](ctx::continuation&& c)
+			{
+				tracked.get();
+				c = c.resume();
+				return M__(c);
+			});
+		CHECK(before + 1 == counted::live);
+		c = c.resume();
+		CHECK(!c);
+	}
+	CHECK(before == counted::live);
+	{
+		// destroyed while parked
+		ctx::continuation c = ctx::callcc(
+			[](ctx::continuation&& c)
+			{
+				tracked.get();
+				for (;;)
+				{
+					c = c.resume();
+				}
+				return M__(c);
+			});
+		CHECK(before + 1 == counted::live);
+	}
+	CHECK(before == counted::live);
+}
+
+// takes every slot left; has to run last
+static void out_of_slots()
+{
+	vector<unique_ptr<ctx::continuation_local<int>>> keys;
+	bool thrown = false;
+	while (!thrown)
+	{
+		CHECK(keys.size() <= ctx::detail::local_slots);
+		try
+		{
+			keys.push_back(make_unique<ctx::continuation_local<int>>());
+		}
+		catch (length_error const&)
+		{
+			thrown = true;
+		}
+	}
+	// `id` and `tracked` hold the other two
+	CHECK(ctx::detail::local_slots == keys.size() + 2);
+	// the last slot is usable
+	ctx::continuation_local<int>& last = *keys.back();
+	ctx::callcc(
+		[&last](ctx::continuation&& c)
+		{
+			*last = 7;
+			c = c.resume();
+			CHECK(7 == *last);
+			return M__(c);
+		})
+		.resume();
+	CHECK(0 == *last);
+}
+
+int main()
+{
+	isolation();
+	destruction();
+	out_of_slots();
+	return 0;
+}
@@ -0,0 +1,92 @@
+// ctx::stack_reclaimer: dead stack pages of idle contexts are handed back,
+// live frames survive, contexts resumed while another thread ticks
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "../myreclaim.hpp"
+#include "check.hpp"
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+// dirties `n` * 64KB of stack below the caller
+__attribute__((noinline)) static void deep(int n)
+{
+	volatile char buf[64 * 1024];
+	for (unsigned i = 0; i < sizeof buf; i += 512)
+	{
+		buf[i] = 1;
+	}
+	if ((0 < n))
+	{
+		deep(n - 1);
+	}
+}
+
+static void reclaim(ctx::stack_reclaimer::mode m)
+{
+	ctx::stack_reclaimer r{m};
+	vector<ctx::continuation> cs;
+	for (int i = 0; i < 50; ++i)
+	{
+		cs.push_back(ctx::callcc(
+			[i](ctx::continuation&& c)
+			{
+				// lives above the saved stack pointer, must survive
+				volatile int id = i;
+				deep(8);
+				for (;;)
+				{
+					c = c.resume();
+					CHECK(i == id);
+					deep(1);
+				}
+				return M__(c);
+			}));
+	}
+	// suspended during this interval, not idle for a full one yet
+	ctx::reclaim_stats s = r.tick();
+	CHECK(50 == s.scanned && 0 == s.idle && 0 == s.released);
+	s = r.tick();
+	CHECK(50 == s.idle);
+	CHECK(50 * 8 * 64 * 1024 <= s.released);
+	// once per suspension
+	s = r.tick();
+	CHECK(0 == s.idle && 0 == s.released);
+	for (auto& c : cs)
+	{
+		c = c.resume();
+	}
+	r.tick();
+	s = r.tick();
+	CHECK(50 == s.idle && 0 < s.released);
+
+	atomic<bool> stop{false};
+	thread ticker{[&]
+				  {
+					  while (!stop)
+					  {
+						  r.tick(0);
+					  }
+				  }};
+	for (int k = 0; k < 50; ++k)
+	{
+		for (auto& c : cs)
+		{
+			c = c.resume();
+		}
+	}
+	stop = true;
+	ticker.join();
+	CHECK(0 < r.total());
+	cs.clear();
+	CHECK(ctx::detail::idle_contexts.records.empty());
+}
+
+int main()
+{
+	reclaim(ctx::stack_reclaimer::mode::release);
+	reclaim(ctx::stack_reclaimer::mode::pageout);
+	return 0;
+}
@@ -0,0 +1,149 @@
+// ctx::sim::scheduler: virtual time, replay by seed, fault injection,
+// parked contexts unwound with the scheduler, exceptions out of run()
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+#include "../mysimulator.hpp"
+#include "check.hpp"
+
+using namespace std;
+using namespace std::chrono_literals;
+
+struct run_result
+{
+	uint64_t trace;
+	int faults;
+	vector<int> finished;
+};
+
+static run_result traffic(uint64_t seed)
+{
+	ctx::sim::scheduler s{seed};
+	s.set_fault_rate(0.05);
+	run_result r{0, 0, {}};
+	for (int i = 0; i < 20; ++i)
+	{
+		s.spawn(
+			[&, i](ctx::continuation& c)
+			{
+				for (int k = 0; k < 100; ++k)
+				{
+					try
+					{
+						s.io(c, ctx::sim::pareto(100us, 1.5));
+					}
+					catch (system_error const& e)
+					{
+						CHECK(e.code() == make_error_code(errc::io_error));
+						++r.faults;
+					}
+					s.sleep(c, 1ms);
+				}
+				r.finished.push_back(i);
+			});
+	}
+	bool fired = false;
+	s.set_timeout(
+		[&]
+		{
+			CHECK(1s == s.now());
+			fired = true;
+		},
+		1000);
+	s.run();
+	CHECK(fired && 20 == r.finished.size() && 0 == s.pending());
+	// 100 sleeps of 1ms each, plus the I/O
+	CHECK(100ms < s.now());
+	r.trace = s.trace();
+	return r;
+}
+
+static void replay()
+{
+	run_result a = traffic(1), b = traffic(1), c = traffic(2);
+	CHECK(a.trace == b.trace && a.faults == b.faults && a.finished == b.finished);
+	CHECK(a.trace != c.trace);
+	CHECK(0 < a.faults);
+}
+
+static void virtual_time()
+{
+	ctx::sim::scheduler s;
+	vector<int> order;
+	s.schedule([&] { order.push_back(2); }, 2ms);
+	s.schedule([&] { order.push_back(1); }, 1ms);
+	s.spawn(
+		[&](ctx::continuation& c)
+		{
+			s.sleep(c, 1h);
+			order.push_back(3);
+		});
+	CHECK(1 == s.run_for(0ms));
+	CHECK(2 == s.run_for(1s));
+	CHECK(1s == s.now() && 1 == s.pending());
+	CHECK(1 == s.run());
+	CHECK(1h == s.now());
+	CHECK((order == vector<int>{1, 2, 3}));
+
+	ctx::sim::latency fixed = ctx::sim::fixed(5ms);
+	ctx::sim::latency uniform = ctx::sim::uniform(1ms, 2ms);
+	for (int i = 0; i < 1000; ++i)
+	{
+		CHECK(5ms == fixed(s));
+		auto d = uniform(s);
+		CHECK(1ms <= d && d < 2ms);
+		CHECK(0ns <= ctx::sim::exponential(1ms)(s));
+		CHECK(1ms <= ctx::sim::pareto(1ms, 1.5)(s));
+	}
+}
+
+static void unwind()
+{
+	int unwound = 0;
+	struct counted
+	{
+		int& n;
+		~counted()
+		{
+			++n;
+		}
+	};
+	{
+		ctx::sim::scheduler s;
+		s.spawn(
+			[&](ctx::continuation& c)
+			{
+				counted g{unwound};
+				s.sleep(c, 1h);
+			});
+		s.run_for(1s);
+		CHECK(0 == unwound);
+	}
+	CHECK(1 == unwound);
+
+	ctx::sim::scheduler s;
+	s.spawn(
+		[&](ctx::continuation& c)
+		{
+			s.sleep(c, 1ms);
+			throw runtime_error("boom");
+		});
+	bool caught = false;
+	try
+	{
+		s.run();
+	}
+	catch (runtime_error const&)
+	{
+		caught = true;
+	}
+	CHECK(caught);
+}
+
+int main()
+{
+	replay();
+	virtual_time();
+	unwind();
+	return 0;
+}
@@ -0,0 +1,147 @@
+// ctx::stream over a socketpair: writers from many contexts coalesced into
+// batches, a large write, zero-copy echo of read slices, end of stream
+#include <map>
+#include <string>
+#include "../mystream.hpp"
+#include "check.hpp"
+#include <sys/socket.h>
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+static void shutdown_write(uv_stream_t* handle)
+{
+	uv_shutdown(new uv_shutdown_t, handle, [](uv_shutdown_t* req, int) { delete req; });
+}
+
+static void echo(uv_loop_t* loop)
+{
+	int fds[2];
+	CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	uv_pipe_t near, far;
+	uv_pipe_init(loop, &near, 0);
+	uv_pipe_init(loop, &far, 0);
+	CHECK(0 == uv_pipe_open(&near, fds[0]));
+	CHECK(0 == uv_pipe_open(&far, fds[1]));
+
+	ctx::buffer_pool pool{4096, 8};
+	auto* client = new ctx::stream{reinterpret_cast<uv_stream_t*>(&near), pool};
+	auto* server = new ctx::stream{reinterpret_cast<uv_stream_t*>(&far), pool};
+
+	// echoes what it reads, then shuts its side down
+	size_t echoed = 0;
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			for (ctx::slice s = server->read(c); !s.empty(); s = server->read(c))
+			{
+				echoed += s.size();
+				server->write(c, M__(s));
+			}
+			shutdown_write(reinterpret_cast<uv_stream_t*>(&far));
+			return M__(c);
+		});
+
+	int writers = 0;
+	string big(2 << 20, 'x');
+	for (int w = 0; w < 10; ++w)
+	{
+		ctx::callcc(
+			[&, w](ctx::continuation&& c)
+			{
+				++writers;
+				for (int i = 0; i < 100; ++i)
+				{
+					string id = "w" + to_string(w) + ":", seq = to_string(i) + ";";
+					uv_buf_t bufs[2] = {uv_buf_init(id.data(), id.size()), uv_buf_init(seq.data(), seq.size())};
+					client->writev(c, bufs, 2);
+				}
+				if ((0 == --writers))
+				{
+					shutdown_write(reinterpret_cast<uv_stream_t*>(&near));
+				}
+				return M__(c);
+			});
+	}
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			++writers;
+			uv_buf_t buf = uv_buf_init(big.data(), big.size());
+			client->writev(c, &buf, 1);
+			if ((0 == --writers))
+			{
+				shutdown_write(reinterpret_cast<uv_stream_t*>(&near));
+			}
+			return M__(c);
+		});
+
+	string got;
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			char a[7], b[300];
+			for (;;)
+			{
+				uv_buf_t bufs[2] = {uv_buf_init(a, sizeof a), uv_buf_init(b, sizeof b)};
+				size_t n = client->readv(c, bufs, 2);
+				if ((0 == n))
+				{
+					break;
+				}
+				got.append(a, min(n, sizeof a));
+				if ((n > sizeof a))
+				{
+					got.append(b, n - sizeof a);
+				}
+			}
+			return M__(c);
+		});
+
+	uv_run(loop, UV_RUN_DEFAULT);
+	CHECK(0 == writers);
+	CHECK(echoed == got.size());
+
+	// the writers move in lockstep: all of them queue in the first loop
+	// iteration, then each completed batch resumes them together and they
+	// form the next one; one uv_try_write() per round
+	CHECK(10 * 100 + 1 == client->writes());
+	CHECK(100 == client->batches());
+
+	// each write arrives in one piece, each writer's in order
+	size_t at = got.find('x');
+	CHECK(string::npos != at && 0 == got.compare(at, big.size(), big));
+	got.erase(at, big.size());
+	map<int, int> next;
+	for (size_t pos = 0; pos < got.size();)
+	{
+		int w = -1, i = -1, len = 0;
+		CHECK(2 == sscanf(got.c_str() + pos, "w%d:%d;%n", &w, &i, &len));
+		CHECK(next[w]++ == i);
+		pos += len;
+	}
+	CHECK(10 == next.size());
+	for (auto const& [w, n] : next)
+	{
+		CHECK(100 == n);
+	}
+
+	// every chunk is back in the pool once the streams let go of the ones
+	// they read into
+	delete client;
+	delete server;
+	CHECK(pool.slabs() * 8 == pool.available());
+	uv_close(reinterpret_cast<uv_handle_t*>(&near), nullptr);
+	uv_close(reinterpret_cast<uv_handle_t*>(&far), nullptr);
+	uv_run(loop, UV_RUN_DEFAULT);
+}
+
+int main()
+{
+	uv_loop_t loop;
+	uv_loop_init(&loop);
+	echo(&loop);
+	CHECK(0 == uv_loop_close(&loop));
+	return 0;
+}
@@ -0,0 +1,170 @@
+// the scenarios the sanitizer/valgrind builds must get through without a report:
+// ping-pong between two contexts, nested callcc(), forced unwinding, exceptions
+// carried over to the resumer
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../mycontinuation_ucontext.hpp"
+#include "check.hpp"
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+static void ping_pong()
+{
+	int n = 10000;
+	auto c = ctx::callcc(
+		[n](ctx::continuation&& c)
+		{
+			for (int i = 0; i < n; ++i)
+			{
+				c = c.resume(i);
+				CHECK(c.get_data<int>() == i + 1);
+			}
+			return M__(c);
+		});
+	for (int i = 0; i < n; ++i)
+	{
+		CHECK(c.get_data<int>() == i);
+		c = c.resume(i + 1);
+	}
+	CHECK(!c);
+}
+
+static void nested()
+{
+	string trace;
+	auto outer = ctx::callcc(
+		[&trace](ctx::continuation&& main)
+		{
+			trace += "o1 ";
+			auto inner = ctx::callcc(
+				[&trace](ctx::continuation&& outer)
+				{
+					trace += "i1 ";
+					outer = outer.resume();
+					trace += "i2 ";
+					return M__(outer);
+				});
+			main = main.resume();
+			trace += "o2 ";
+			inner = inner.resume();
+			CHECK(!inner);
+			return M__(main);
+		});
+	trace += "m1 ";
+	outer = outer.resume();
+	CHECK(!outer);
+	CHECK(trace == "o1 i1 m1 o2 i2 ");
+}
+
+static void forced_unwind()
+{
+	int destroyed = 0;
+	struct guard
+	{
+		int& n;
+		~guard()
+		{
+			++n;
+		}
+	};
+	{
+		vector<ctx::continuation> parked;
+		for (int i = 0; i < 100; ++i)
+		{
+			parked.push_back(ctx::callcc(
+				[&destroyed](ctx::continuation&& c)
+				{
+					guard g{destroyed};
+					vector<string> heap(8, string(64, 'x'));
+					for (;;)
+					{
+						c = c.resume();
+					}
+					return M__(c);
+				}));
+		}
+		// a stack mapped where a force-unwound one was must not inherit its state
+		parked.erase(parked.begin(), parked.begin() + 50);
+		CHECK(destroyed == 50);
+		for (auto& c : parked)
+		{
+			c = c.resume();
+		}
+	}
+	CHECK(destroyed == 100);
+}
+
+static void exceptions()
+{
+	int destroyed = 0;
+	struct guard
+	{
+		int& n;
+		~guard()
+		{
+			++n;
+		}
+	};
+
+	// thrown after a few switches, rethrown by the resume() that switched in
+	auto c = ctx::callcc(
+		[&destroyed](ctx::continuation&& c)
+		{
+			guard g{destroyed};
+			for (int i = 0; i < 3; ++i)
+			{
+				c = c.resume(i);
+			}
+			throw runtime_error("mid-run");
+			return M__(c);
+		});
+	int switches = 0;
+	bool caught = false;
+	try
+	{
+		while (c)
+		{
+			CHECK(c.get_data<int>() == switches++);
+			c = c.resume();
+		}
+	}
+	catch (runtime_error const& e)
+	{
+		caught = string("mid-run") == e.what();
+	}
+	CHECK(caught && 3 == switches && 1 == destroyed);
+
+	// thrown before the first switch back, rethrown by callcc()
+	caught = false;
+	try
+	{
+		ctx::callcc(
+			[&destroyed](ctx::continuation&& c)
+			{
+				guard g{destroyed};
+				throw logic_error("first entry");
+				return M__(c);
+			});
+	}
+	catch (logic_error const& e)
+	{
+		caught = string("first entry") == e.what();
+	}
+	CHECK(caught && 2 == destroyed);
+
+	// switching still works afterwards
+	ping_pong();
+}
+
+int main()
+{
+	ping_pong();
+	nested();
+	forced_unwind();
+	forced_unwind();
+	exceptions();
+	return 0;
+}
@@ -0,0 +1,269 @@
+// ctx::task_group: join, failure and cancellation, and cancel() racing a
+// child that is about to park on another thread
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "../mytask_group.hpp"
+#include "check.hpp"
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+struct counted
+{
+	int& n;
+	~counted()
+	{
+		++n;
+	}
+};
+
+static bool is_canceled(system_error const& e)
+{
+	return e.code() == make_error_code(errc::operation_canceled);
+}
+
+static void join_all()
+{
+	vector<function<void()>> wakers;
+	int finished = 0;
+	bool joined = false;
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			ctx::task_group g;
+			for (int i = 0; i < 3; ++i)
+			{
+				g.spawn(
+					[&](ctx::task_group::child& ch)
+					{
+						for (int k = 0; k < 2; ++k)
+						{
+							ch.park([&](auto wake) { wakers.push_back(wake); });
+						}
+						++finished;
+					});
+			}
+			g.join(c);
+			joined = true;
+			return M__(c);
+		});
+	while (!wakers.empty())
+	{
+		CHECK(!joined);
+		auto wake = M__(wakers.front());
+		wakers.erase(wakers.begin());
+		wake();
+	}
+	CHECK(3 == finished && joined);
+}
+
+static void failure()
+{
+	vector<function<void()>> wakers;
+	int unwound = 0;
+	string error;
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			ctx::task_group g;
+			for (int i = 0; i < 3; ++i)
+			{
+				g.spawn(
+					[&, i](ctx::task_group::child& ch)
+					{
+						counted n{unwound};
+						ch.park([&](auto wake) { wakers.push_back(wake); });
+						if ((1 == i))
+						{
+							throw runtime_error("child 1 failed");
+						}
+						ch.park([](auto) {});
+					});
+			}
+			try
+			{
+				g.join(c);
+			}
+			catch (runtime_error const& e)
+			{
+				error = e.what();
+			}
+			return M__(c);
+		});
+	// the failure unwinds the other two children, parked or not
+	wakers.at(1)();
+	CHECK(3 == unwound);
+	CHECK("child 1 failed" == error);
+	// a waker of a cancelled child does nothing
+	wakers.at(0)();
+}
+
+// arm wakes the child right away; the child parks again before arm returned
+static void sync_wake()
+{
+	int armed = 0;
+	bool finished = false;
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			ctx::task_group g;
+			g.spawn(
+				[&](ctx::task_group::child& ch)
+				{
+					auto p = make_shared<int>(7);
+					for (int k = 0; k < 3; ++k)
+					{
+						ch.park(
+							[p, &armed](auto wake)
+							{
+								wake();
+								// the closure holding `p` must still be alive
+								CHECK(7 == *p);
+								++armed;
+							});
+					}
+					finished = true;
+				});
+			g.join(c);
+			return M__(c);
+		});
+	CHECK(finished && 3 == armed);
+}
+
+// a child cancelling its own group gets operation_canceled from its next park()
+static void cancel_running()
+{
+	function<void()> waker;
+	bool canceled = false;
+	bool joined = false;
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			ctx::task_group g;
+			g.spawn(
+				[&](ctx::task_group::child& ch)
+				{
+					ch.park([&](auto wake) { waker = wake; });
+					g.cancel();
+					try
+					{
+						ch.park([](auto) {});
+					}
+					catch (system_error const& e)
+					{
+						canceled = is_canceled(e);
+					}
+				});
+			try
+			{
+				g.join(c);
+			}
+			catch (system_error const& e)
+			{
+				joined = is_canceled(e);
+			}
+			return M__(c);
+		});
+	waker();
+	CHECK(canceled && joined);
+}
+
+// children hop between this thread and a worker until cancel() from a third
+// thread catches them; those about to park at that moment must not be left
+// parked where nothing wakes them, join() would never return
+static void cancel_race(unsigned seed)
+{
+	mutex m;
+	vector<function<void()>> queue;
+	atomic<bool> stop{false}, joined{false};
+	// outlives the parent context, cancel() may still run when join() returned
+	ctx::task_group g;
+
+	thread worker{[&]
+				  {
+					  while (!stop)
+					  {
+						  function<void()> wake;
+						  {
+							  lock_guard<mutex> lk{m};
+							  if (!queue.empty())
+							  {
+								  wake = M__(queue.back());
+								  queue.pop_back();
+							  }
+						  }
+						  if (wake)
+						  {
+							  wake();
+						  }
+						  else
+						  {
+							  this_thread::yield();
+						  }
+					  }
+				  }};
+
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				g.spawn(
+					[&](ctx::task_group::child& ch)
+					{
+						for (;;)
+						{
+							ch.park(
+								[&](auto wake)
+								{
+									lock_guard<mutex> lk{m};
+									queue.push_back(wake);
+								});
+						}
+					});
+			}
+			try
+			{
+				g.join(c);
+			}
+			catch (system_error const& e)
+			{
+				CHECK(is_canceled(e));
+			}
+			joined = true;
+			return M__(c);
+		});
+	thread canceller{[&]
+					 {
+						 this_thread::sleep_for(chrono::microseconds{mt19937{seed}() % 300});
+						 g.cancel();
+					 }};
+	for (int ms = 0; !joined; ++ms)
+	{
+		CHECK(ms < 10000);
+		this_thread::sleep_for(chrono::milliseconds{1});
+	}
+	canceller.join();
+	stop = true;
+	worker.join();
+}
+
+int main()
+{
+	join_all();
+	failure();
+	sync_wake();
+	cancel_running();
+	for (unsigned seed = 0; seed < 200; ++seed)
+	{
+		cancel_race(seed);
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+// ctx::uring, natively or through the libuv fallback: pipe, file, accept and
+// timeout requests from contexts parked at the same time
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "../myuring.hpp"
+#include "check.hpp"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+
+#define M__(x) std::move(x)
+
+using namespace std;
+
+static void requests(uv_loop_t* loop)
+{
+	ctx::uring ring{64, loop};
+	fprintf(stderr, "native %d\n", ring.native());
+
+	int fds[2];
+	CHECK(0 == pipe(fds));
+	char path[] = "/tmp/ctx_uringXXXXXX";
+	int file = mkstemp(path);
+	CHECK(0 <= file);
+	unlink(path);
+	int lfd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in sa{};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t sl = sizeof sa;
+	CHECK(0 == ::bind(lfd, (sockaddr*)&sa, sizeof sa));
+	CHECK(0 == listen(lfd, 4));
+	CHECK(0 == getsockname(lfd, (sockaddr*)&sa, &sl));
+
+	static char fixed[64];
+	iovec iov{fixed, sizeof fixed};
+	ring.register_buffers(&iov, 1);
+	ring.register_files(&file, 1);
+
+	int done = 0;
+	// parks on the empty pipe, then on the listening socket
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			char buf[16] = {};
+			CHECK(5 == ring.read(c, fds[0], buf, sizeof buf));
+			CHECK(0 == strcmp(buf, "hello"));
+			int fd = ring.accept(c, lfd);
+			CHECK(0 <= fd);
+			close(fd);
+			++done;
+			return M__(c);
+		});
+	ctx::callcc(
+		[&](ctx::continuation&& c)
+		{
+			auto t0 = chrono::steady_clock::now();
+			CHECK(0 == ring.timeout(c, 20));
+			CHECK(chrono::steady_clock::now() - t0 >= chrono::milliseconds{20});
+			CHECK(5 == ring.write(c, fds[1], "hello", 5));
+
+			memcpy(fixed, "fixed!", 6);
+			CHECK(6 == ring.write_fixed(c, ctx::fixed_file{0}, fixed, 6, 0, 0));
+			memset(fixed, 0, sizeof fixed);
+			CHECK(6 == ring.read_fixed(c, file, fixed, 6, 0, 0));
+			CHECK(0 == memcmp(fixed, "fixed!", 6));
+
+			int s = socket(AF_INET, SOCK_STREAM, 0);
+			CHECK(0 == connect(s, (sockaddr*)&sa, sizeof sa));
+			close(s);
+			++done;
+			return M__(c);
+		});
+	CHECK(0 == done);
+	uv_run(loop, UV_RUN_DEFAULT);
+	CHECK(2 == done);
+	close(fds[0]);
+	close(fds[1]);
+	close(file);
+	close(lfd);
+}
+
+int main()
+{
+	uv_loop_t loop;
+	uv_loop_init(&loop);
+	requests(&loop);
+	// the ring's handles are closed by ~uring() without running the loop
+	uv_run(&loop, UV_RUN_DEFAULT);
+	CHECK(0 == uv_loop_close(&loop));
+	return 0;
+}